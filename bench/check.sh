@@ -0,0 +1,57 @@
+#!/bin/sh
+# Replays short sessions that end in a save and compares the file with what it should be
+# usage: bench/check.sh [path to wynaut]
+set -e
+
+WY=${1:-$(cd "$(dirname "$0")/.." && pwd)/wynaut}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+FAIL=0
+
+# check name keys [file...]: replays keys against $DIR/in and any more files given,
+# then compares $DIR/in with $DIR/want
+check(){
+	name=$1
+	printf '%b' "$2" > "$DIR/keys"
+	shift 2
+	"$WY" --replay "$DIR/keys" --size 24x80 "$DIR/in" "$@" 2>/dev/null || true
+	if cmp -s "$DIR/in" "$DIR/want"; then
+		echo "ok   $name"
+	else
+		echo "FAIL $name"
+		diff "$DIR/want" "$DIR/in" || true
+		FAIL=1
+	fi
+}
+
+# fuzzy find has to match queries whose chars are several bytes apart
+printf 'one\nhello world\nfoo_bar_baz\na    b\n' > "$DIR/in"
+printf 'one\n#hello world\nfoo_bar_baz\na    b\n' > "$DIR/want"
+check "fuzzy gap" '\020hw\r#\023\021'
+printf 'one\nhello world\nfoo_bar_baz\na    b\n' > "$DIR/in"
+printf 'one\nhello world\n#foo_bar_baz\na    b\n' > "$DIR/want"
+check "fuzzy gaps" '\020fbb\r#\023\021'
+
+# undoing a step bigger than the undo budget has nothing to undo, the paste stays
+printf 'a\nb\n' > "$DIR/in"
+awk 'BEGIN { for (i = 0; i < 40; i++) printf "pasted line %d\n", i; printf "a\nb\n" }' > "$DIR/want"
+export WYNAUT_UNDO_BUDGET=300
+check "undo past budget" "\033[200~$(awk 'BEGIN { for (i = 0; i < 40; i++) printf "pasted line %d\\r", i }')\033[201~\032\023\021"
+unset WYNAUT_UNDO_BUDGET
+
+# the same file under other names is one buffer, whether named on the command line or opened
+printf 'abc\n' > "$DIR/in"
+printf 'xyzabc\n' > "$DIR/want"
+check "same file" 'x\016y\017'"$DIR/./in"'\rz\023\021' "$DIR/../$(basename "$DIR")/in"
+
+# line numbers are decimal even with leading zeros, offsets may be hex
+seq 1 20 > "$DIR/in"
+seq 1 20 | sed -e 's/^9$/%9/' -e 's/^10$/#10/' > "$DIR/want"
+check "go to" '\a010\r#\a@0x10\r%\023\021'
+
+# a replace whose pattern doesn't parse leaves the cursor where it was
+(seq 1 29; echo zz; seq 31 40) > "$DIR/in"
+(echo '#1'; seq 2 29; echo zz; seq 31 40) > "$DIR/want"
+check "replace bad regex" '\022\005zz(\r#\023\021'
+
+exit $FAIL
@@ -0,0 +1,48 @@
+#!/bin/sh
+# Replays a few standard sessions against generated files and prints the timings
+# usage: bench/run.sh [path to wynaut]
+set -e
+
+# paths are taken from where the script is, so it runs from any directory
+TOP=$(cd "$(dirname "$0")/.." && pwd)
+WY=${1:-$TOP/wynaut}
+SIZE=${SIZE:-50x160}
+# not LINES, the shell keeps the terminal's height in that
+BENCH_LINES=${BENCH_LINES:-200000}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# plain text and C, the C file exercises keywords and multi-line comments
+awk -v n="$BENCH_LINES" 'BEGIN { for (i = 1; i <= n; i++) printf "line %d: the quick brown fox jumps over the lazy dog %d\n", i, i * 7 }' > "$DIR/big.txt"
+i=0
+while [ $i -lt 40 ]; do cat "$TOP/wynaut.c"; i=$((i + 1)); done > "$DIR/big.c"
+
+# typing: a few hundred lines typed in the middle of the C file
+awk 'BEGIN {
+	for (i = 0; i < 1200; i++) printf "\033[6~"
+	for (i = 0; i < 300; i++) printf "\tint x%d = %d; /* typed */\r", i, i
+}' > "$DIR/typing.keys"
+
+# paging: down through the file and back up
+awk 'BEGIN { for (i = 0; i < 2000; i++) printf "\033[6~"; for (i = 0; i < 2000; i++) printf "\033[5~" }' > "$DIR/paging.keys"
+
+# search: a query typed one key at a time, then stepping through matches
+awk 'BEGIN { printf "\006lazy dog 7"; for (i = 0; i < 200; i++) printf "\033[B"; printf "\r" }' > "$DIR/search.keys"
+
+# paste: 10k lines arriving as one bracketed paste
+awk 'BEGIN { printf "\033[200~"; for (i = 0; i < 10000; i++) printf "pasted line %d of some text\r", i; printf "\033[201~" }' > "$DIR/paste.keys"
+
+# save: an edit and a save, a few times over
+awk 'BEGIN { for (i = 0; i < 10; i++) printf "x\023" }' > "$DIR/save.keys"
+
+run(){
+	echo "== $1 ($2)"
+	"$WY" --replay "$DIR/$1.keys" --size "$SIZE" "$DIR/$2"
+	echo
+}
+
+run typing big.c
+run paging big.txt
+run search big.txt
+run paste big.c
+run save big.txt
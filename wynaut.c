@@ -1,5 +1,3 @@
-// @TODO Step 175
-// consider adding fuzzy search 
 /** includes **/
 
 #define _DEFAULT_SOURCE
@@ -16,8 +14,19 @@
 #include <time.h>
 #include <stdarg.h>
 #include <string.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <dirent.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /** defines **/
 
@@ -25,6 +34,29 @@
 #define WYNAUT_VERSION "0.0.1"
 #define WYNAUT_TAB_STOP 4
 #define WYNAUT_QUIT_TIMES 3
+#define WYNAUT_ROW_CHUNK 512 // rows per leaf of the row tree
+#define WYNAUT_PAGE_LINES 8192 // rows per entry of the line index built when a file is opened
+#define WYNAUT_PAGE_BUDGET (256 << 20) // bytes rows may take before chunks are paged out, set with WYNAUT_PAGE_BUDGET=n
+#define WYNAUT_SLAB (64 << 10) // bytes per slab of the row allocator
+#define WYNAUT_RENDER_BUDGET (64 << 20) // bytes of render/hl kept around before cold rows are evicted
+#define WYNAUT_SAVE_IOV 1024 // iovecs handed to each writev when saving
+#define WYNAUT_SAVE_COPY (1 << 20) // bytes per read when saving rows from the scratch file
+#define WYNAUT_SLICE_US 8000 // longest stretch of background work between checks for input
+#define WYNAUT_HL_SYNC 4096 // comment state this many rows behind is caught up while drawing, further is left to the worker
+#define WYNAUT_HL_BATCH 1024 // rows the syntax worker catches up between looks at the clock
+#define WYNAUT_INPUT_BUF (1 << 16) // bytes of the input ring, a power of two
+#define WYNAUT_ESC_MS 50 // how long the rest of an escape sequence may take to arrive
+#define WYNAUT_COL_STRIDE 1024 // chars between the column checkpoints of rows with tabs
+#define WYNAUT_LONG_LINE (1 << 16) // longer rows only render the part around the screen
+#define WYNAUT_LONG_MARGIN 4096 // columns rendered on either side of the screen for those
+#define WYNAUT_FUZZY_TOP 100 // best matches kept by fuzzy find
+#define WYNAUT_FUZZY_THREADS 8 // most threads scoring rows for fuzzy find
+#define WYNAUT_INDEX_THREADS 8 // most threads scanning a file for its lines when it is opened
+#define WYNAUT_INDEX_SLICE (16 << 20) // fewest bytes each of those threads is given
+#define WYNAUT_UNDO_BUDGET (16 << 20) // bytes of undo history kept, set with WYNAUT_UNDO_BUDGET=n
+#define WYNAUT_REGEX_STATES 2048 // DFA states a regex search keeps before starting over, a power of two
+#define WYNAUT_REPLACE_THREADS 8 // most threads rebuilding rows for replace all
+#define WYNAUT_REPLACE_BATCH (1 << 16) // rows each of them rebuilds before the results are put in place
 
 // ANDs a character with 00011111	
 // returns the ctrl + k combination
@@ -41,12 +73,22 @@ enum editorKey{
 	HOME_KEY,
 	END_KEY,
 	PAGE_UP,
-	PAGE_DOWN
+	PAGE_DOWN,
+	PASTE_START, // bracketed paste, the text in between is inserted in one go
+	PASTE_END
+};
+
+// How hard editorSave pushes data to the disk, set with WYNAUT_FSYNC=0/1/2
+enum editorFsync {
+	FSYNC_NONE = 0, // leave it to the kernel
+	FSYNC_FILE, // fsync the file before renaming it into place
+	FSYNC_DIR // also fsync the directory so the rename itself is durable
 };
 
 enum editorHighlight {
 	HL_NORMAL = 0,
 	HL_COMMENT,
+	HL_MLCOMMENT,
 	HL_KEYWORD1,
 	HL_KEYWORD2,
 	HL_STRING,
@@ -54,29 +96,321 @@ enum editorHighlight {
 	HL_MATCH
 };
 
+// what an undo op did, undoing it does the opposite
+enum undoKind {
+	UNDO_INSERT = 0, // text inserted into a row
+	UNDO_DELETE, // text deleted from a row
+	UNDO_INSERT_ROW,
+	UNDO_DELETE_ROW
+};
+
+#define HL_TYPES (HL_MATCH + 1)
+
 #define HL_HIGHLIGHT_NUMBERS (1<<0)
 #define HL_HIGHLIGHT_STRINGS (1<<1)
 
+// erow flags
+#define ROW_MAPPED (1<<0) // chars point into the file mapping or the chunk's buffer, not the heap
+#define ROW_STALE (1<<1) // chars changed since render and hl were built
+#define ROW_RENDER_SHARED (1<<2) // the row has no tabs, render points at chars
+#define ROW_NOTABS (1<<3) // chars are known to have no tabs, cleared when they change
+#define ROW_PLAIN (1<<4) // hl was left plain because the comment state wasn't known yet
+#define ROW_PINNED (1<<5) // chars are part of the snapshot a save is writing, see editorSave
+
+/** allocation counting **/
+
+// Everything the editor allocates goes through these so a replay can report how much
+// that is. Fuzzy find allocates on its workers, hence the atomics.
+long long alloc_count;
+long long alloc_bytes;
+
+void allocCount(size_t n){
+	__atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&alloc_bytes, n, __ATOMIC_RELAXED);
+}
+
+void* xmalloc(size_t n){
+	allocCount(n);
+	return malloc(n);
+}
+
+void* xcalloc(size_t n, size_t size){
+	allocCount(n * size);
+	return calloc(n, size);
+}
+
+void* xrealloc(void* p, size_t n){
+	allocCount(n);
+	return realloc(p, n);
+}
+
+char* xstrdup(const char* s){
+	allocCount(strlen(s) + 1);
+	return strdup(s);
+}
+
+char* xstrndup(const char* s, size_t n){
+	allocCount(n + 1);
+	return strndup(s, n);
+}
+
+// counts an allocation whenever the line buffer had to grow
+ssize_t xgetline(char** line, size_t* cap, FILE* fp){
+	size_t before = *cap;
+	ssize_t n = getline(line, cap, fp);
+	if (*cap != before) allocCount(*cap);
+	return n;
+}
+
+char* xrealpath(const char* name){
+	char* path = realpath(name, NULL);
+	if (path) allocCount(strlen(path) + 1);
+	return path;
+}
+
 /** data **/
 
+// A keyword list compiled into a trie laid out as a transition table.
+// Bytes that appear in some keyword get a column, every other byte maps to
+// column 0 which always leads to the dead state 0. State 1 is the root.
+struct keywordMatcher {
+	unsigned char cls[256];
+	int nclasses;
+	int* next; // nstates * nclasses
+	unsigned char* hl; // HL_KEYWORD1/HL_KEYWORD2 for states that end a keyword, HL_NORMAL otherwise
+	int* rank; // position of that keyword in the list, earlier entries win
+	int sep; // a match has to be followed by a separator, keywords do but comment markers don't
+};
+
+// What the lexer knows about the bytes before the current one, see the syntax highlighting section
+enum lexMode {
+	LEX_SEP = 0, // code after a separator, keywords and numbers may start here
+	LEX_WORD, // code inside a word
+	LEX_NUM, // code right after a digit of a number
+	LEX_COMMENT, // inside a multi-line comment
+	LEX_DQUOTE, // inside a "string"
+	LEX_DQUOTE_ESC, // right after a backslash in one
+	LEX_SQUOTE,
+	LEX_SQUOTE_ESC,
+	LEX_MODES
+};
+
+#define LEX_MARKER (1<<0) // a comment marker may start at this byte
+#define LEX_KEYWORD (1<<1) // a keyword may
+
+// what one byte does in one mode
+struct lexStep {
+	unsigned char next; // mode after it
+	unsigned char hl;
+	unsigned char token; // LEX_* of what may start at it, checked before taking the step
+};
+
+// A syntax compiled into tables. Bytes step through step[mode][byte], only where a comment
+// marker or a keyword may start is a trie walked to see if one does.
+struct syntaxLexer {
+	struct lexStep step[LEX_MODES][256];
+	struct keywordMatcher* open; // single-line and multi-line comment starts, NULL if there are none
+	struct keywordMatcher* close; // multi-line comment end, NULL if there is none
+	char closefirst; // its first byte
+	struct keywordMatcher* kw;
+};
+
 // For syntax highlighting purposes
 struct editorSyntax {
 	char* filetype;
 	char** filematch;
 	char** keywords;
 	char* singleline_comment_start;
+	char* multiline_comment_start;
+	char* multiline_comment_end;
 	int flags;
+	struct syntaxLexer* lexer; // compiled the first time the syntax is selected
+};
+
+// rx of every WYNAUT_COL_STRIDE-th char of a row. Only a prefix is known: an edit
+// cuts it back to the edit and conversions extend it as far as they need.
+struct rowCols {
+	int n; // checkpoints known
+	int cap;
+	int rx[];
 };
 
 // defines datatype e(each)row to be a struct with char array and size
 typedef struct erow {
 	int size;
 	int rsize;
+	int cap; // bytes allocated for chars, 0 while they are mapped
+	int rcap; // bytes allocated for render, 0 while it shares chars
+	int hlcap; // bytes allocated for hl
 	char* chars;
-	char* render;
+	char* render; // NULL until the row is first shown
 	unsigned char* hl;
+	int flags;
+	int hlgen; // value of E.hlgen when hl was built
+	int hl_open_comment; // whether the row ends inside a multi-line comment
+	struct rowCols* cols; // column index, only long rows with tabs have one
+	int rx0; // column render starts at, past 0 only for rows longer than WYNAUT_LONG_LINE
+	int cx1; // chars render covers, row->size unless the row is long
 } erow;
 
+// The rows live in a treap of chunks, each holding up to WYNAUT_ROW_CHUNK rows.
+// The treap is keyed implicitly by position, every node keeps the number of
+// chunks and rows in its subtree so finding row n is a walk down one path.
+// A chunk can be paged out, then only where its text lives is kept, see the paging section.
+typedef struct rowchunk {
+	struct rowchunk* left;
+	struct rowchunk* right;
+	unsigned int prio;
+	int chunks; // chunks in this subtree
+	int lines; // rows in this subtree
+	int n; // rows in this chunk
+	erow* rows; // NULL while the chunk is paged out
+	long long src; // where the chunk's text starts in the file mapping, or the scratch file if spilled
+	long long srclen; // bytes of it, newlines included
+	char* buf; // text read back from the scratch file, rows borrow from it
+	long long used; // E.page.clock when the chunk was last looked up
+	int hl_end; // comment state the chunk ends in, kept while it is paged out
+	int flags; // CHUNK_*
+} rowchunk;
+
+#define CHUNK_MODIFIED (1<<0) // rows were added or removed since it was paged in, src is out of date
+#define CHUNK_SPILLED (1<<1) // src is in the scratch file
+#define CHUNK_CR (1<<2) // some line in src ends in \r or has no newline, it can't be saved as is
+
+// A headless run reads its keys from a script and times each one, from the moment the
+// key is read until the editor asks for the next one
+struct editorReplay {
+	long long* lat; // microseconds each key took
+	int nlat;
+	int caplat;
+	long long key_start; // when the key being handled was read, 0 before the first one
+	long long start;
+};
+
+// The syntax worker catches up comment state while the editor waits for keys. The
+// main thread holds lock all the time except around that wait, see the syntax worker section.
+struct editorWorker {
+	pthread_mutex_t lock;
+	pthread_cond_t wake; // signalled whenever the main thread lets go of lock
+	int hold; // the main thread holds lock or is about to take it, read atomically
+	int pipe[2]; // wakes the main thread, written when rows on screen got their highlight or a save moved on
+};
+
+// A stretch of the file a save writes
+struct savePiece {
+	int kind; // one of savePieceKind
+	const char* p; // text of the piece, unless it is in the scratch file
+	long long off; // where it is in the scratch file
+	long long len;
+};
+
+enum savePieceKind {
+	PIECE_ROW = 0, // a row's chars, a newline goes after them
+	PIECE_RAW, // lines of the file mapping that go out as they are
+	PIECE_LINES, // lines of the file mapping whose endings need trimming
+	PIECE_SCRATCH // rows paged out to the scratch file
+};
+
+// A save running in the background. It writes the text every row had when it started;
+// rows edited meanwhile get new chars and their old ones are freed once it is done.
+struct editorSaving {
+	pthread_t thread;
+	int threaded; // 0 when no thread could be started and the save ran in place
+	struct savePiece* pieces; // the snapshot, in file order
+	int npieces;
+	char* filename;
+	int scratchfd; // E.page.scratchfd, the thread doesn't look at E
+	int fsync; // one of editorFsync
+	mode_t newmode; // mode for the file if it doesn't exist yet
+	long long total; // about the bytes to write, line endings may still get trimmed
+	long long written; // bytes written so far, updated atomically
+	int done; // set by the thread once it is finished, read atomically
+	int err; // errno of what went wrong, 0 if the file was saved
+	long long start;
+	long long edits; // E.edits when the snapshot was taken
+	int undo_top; // E.undo.top then, -2 once trimmed out of the history
+	int shown; // percentage last shown in the message bar
+	char** deferred; // chars of pinned rows that were replaced or deleted, and chunk buffers
+	int* deferred_cap; // rowmem capacity of each, -1 for malloced buffers
+	int ndeferred;
+	int capdeferred;
+};
+
+// State of the row allocator, see the row memory section
+#define ROWMEM_CLASSES 16
+
+struct rowMemory {
+	char* freelist[ROWMEM_CLASSES];
+	char* slab[ROWMEM_CLASSES]; // rest of the slab blocks are carved from
+	char* slab_end[ROWMEM_CLASSES];
+	long long slabs; // slabs malloced
+	long long large; // blocks malloced for being too big for a class
+	long long allocs; // blocks handed out
+	long long reused; // of those, how many came off a free list
+	long long grown_in_place; // grow calls the block's slack covered
+	long long bytes; // bytes of blocks in use
+};
+
+// What the probes on the hot paths measured, see the stats section
+enum statProbe {
+	STAT_KEY = 0, // from reading a key to the frame that follows it going out
+	STAT_SYNTAX, // editorUpdateSyntax
+	STAT_RENDER, // editorRowRender, the work editorUpdateRow leaves for the next draw
+	STAT_DRAW, // editorDrawRows
+	STAT_WRITE, // writing a frame to the terminal
+	STAT_PROBES
+};
+
+#define STAT_BUCKETS 33 // bucket b counts times under 2^b ns, the last one everything longer
+
+struct statCounter {
+	long long count;
+	long long total; // ns
+	long long max;
+	long long hist[STAT_BUCKETS];
+};
+
+struct editorStats {
+	struct statCounter probe[STAT_PROBES];
+	long long key_start; // when the key being handled was read, 0 once its frame went out
+	long long frames; // frames written
+	int shown; // the overlay is up, toggled with Ctrl-T
+	char* dump; // where the counters are written on exit, NULL unless --stats was given
+};
+
+// Input waiting to be parsed into keys. head and tail only grow, masking them with
+// WYNAUT_INPUT_BUF - 1 gives the position in buf.
+struct editorInput {
+	unsigned char buf[WYNAUT_INPUT_BUF];
+	unsigned int head; // next byte to parse
+	unsigned int tail; // next byte to fill
+};
+
+// Undo history, an append-only log of ops, see the undo section
+struct editorUndo {
+	char* log;
+	int used;
+	int cap;
+	int budget; // most bytes the log may hold, the oldest steps are dropped past it
+	int top; // offset of the newest op still applied, -1 when there is none
+	int open; // new ops join the current step
+	int dropped; // the open step outgrew the budget, nothing is recorded until it ends
+	int paused; // set while undoing and loading, nothing gets recorded
+	int clean; // top when the file was last saved, -2 when that state is gone
+};
+
+// Chunks of rows are paged in from the file or the scratch file as they are needed and
+// paged out again, least recently used first, once they take more than budget bytes
+struct editorPaging {
+	size_t bytes; // row arrays and buffers of the chunks paged in
+	size_t budget; // bytes rows may take along with their chars and caches
+	long long clock; // bumped on every lookup
+	int scratchfd; // where modified chunks go when paged out, -1 until the first one does
+	long long scratchlen;
+	long long loads; // chunks paged in
+	long long spills; // chunks written to the scratch file
+};
+
 struct editorConfig {
 	int cx,cy; // cursor position
 	int rx;
@@ -85,16 +419,56 @@ struct editorConfig {
 	int screenrows;
 	int screencols;
 	int numrows;
-	erow* row;
+	rowchunk* rows;
 	int dirty; //To check if the input file has been modified in anyway
+	long long edits; // bumped by every change to the rows, unlike dirty it never goes back
 	char* filename; // to be displayed in status bar
+	char* map; // read-only mapping of the opened file, rows borrow from it
+	size_t maplen;
 	char statusmsg[80];
 	time_t statusmsg_time;
 	struct editorSyntax* syntax;
+	int hlgen; // bumped when the syntax changes, invalidates every row's hl at once
+	int syn_lo, syn_hi; // rows whose hl_open_comment may be out of date, empty when syn_lo >= syn_hi
+	size_t cache_bytes; // bytes held by render and hl of all rows
+	int save_fsync; // one of editorFsync
+	mode_t save_mode; // 0666 minus the umask, read once at startup as umask can't be read without setting it
+	struct abuf* frame; // what each screen line currently shows, NULL until the first refresh
+	int framelines;
+	int frame_cy, frame_cx; // where the cursor was left by the last refresh
+	int frame_bytes; // bytes sent to the terminal by the last refresh
+	long long total_frame_bytes;
+	struct editorSearch* search; // match cache of the find prompt, NULL when it is closed
+	struct editorFuzzy* fuzzy; // state of the fuzzy find prompt, NULL when it is closed
+	int infd; // keys come from here, the terminal unless replaying
+	int outfd; // frames go here
+	struct editorReplay* replay; // NULL unless running headless with --replay
+	struct editorUndo undo;
+	struct editorPaging page;
+	struct editorSaving* saving; // the save in progress, NULL when there is none
 	struct termios orig_termios;
 };
 
+// Files open besides the one being edited. That one lives in E, the others are kept as
+// copies of their whole editorConfig and swapped in when switched to, see the buffers section.
+struct editorBuffers {
+	struct editorConfig* list; // list[cur] is out of date while E is in use
+	int n;
+	int cap;
+	int cur;
+};
+
+// escape sequences switching to each highlight's color, see editorBuildEscapes
+char hlEscape[HL_TYPES][16];
+int hlEscapeLen[HL_TYPES];
+
+int rowmemSizes[ROWMEM_CLASSES] = {16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 4096};
+struct rowMemory rowmem;
+struct editorInput input;
+struct editorWorker worker;
+struct editorStats stats;
 struct editorConfig E;
+struct editorBuffers buffers;
 
 /** filetypes **/
 
@@ -112,29 +486,45 @@ struct editorSyntax HLDB[] = {
 	 "c",
 	 C_HL_extensions,
 	C_HL_keywords,
-	"//",
-	 HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+	"//", "/*", "*/",
+	 HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+	 NULL
 	},
 };
 
 #define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
 
+// Definitions read from syntax files at startup, they are looked at before HLDB
+struct editorSyntax** syntaxFiles;
+int nsyntaxFiles;
+
 /** prototypes **/
 
 void editorSetStatusMessage(const char* fmt, ...);
 void editorRefreshScreen();
 char* editorPrompt(char* prompt, void (*callback)(char*, int));
+char* editorPromptRead(char* prompt, void (*callback)(char*, int), int empty);
+int editorIdle();
+int editorSyntaxWork();
+int editorWaitInput();
+void editorSaveDefer(char* chars, int cap);
+rowchunk* rowChunkLoad(rowchunk* t, int ci);
+void editorRowDetach(erow* row);
+void editorUndoRecord(int kind, int row, int at, const char* s, int len);
+void editorBufferUse(int k);
+const char* editorMemmem(const char* hay, int n, const char* needle, int m);
 
 /** terminal **/
 void die(const char *s){
 	// Clears the screen and resets the cursor. See editorRefreshScreen for details
-	write(STDOUT_FILENO,"\x1b[2J",4);
-	write(STDOUT_FILENO,"\x1b[H", 3);
+	write(E.outfd,"\x1b[2J",4);
+	write(E.outfd,"\x1b[H", 3);
 	perror(s);
 	exit(1);
 }
 
 void disableRawMode(){
+	write(E.outfd, "\x1b[?2004l", 8); // bracketed paste off
 	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1){
 		die("tcsetattr");
 	}
@@ -152,8 +542,9 @@ void enableRawMode(){
 	raw.c_oflag &= ~(OPOST);
 	raw.c_cflag |= (CS8);
 	raw.c_lflag &= ~(ECHO| ICANON| ISIG | IEXTEN);
+	// reads never block, editorInputFill polls before reading
 	raw.c_cc[VMIN] = 0;
-	raw.c_cc[VTIME] = 1;
+	raw.c_cc[VTIME] = 0;
 	// removes ECHO - attr which displays user input and ICANON and ISIG which controls SIGINT signals sent by ctrlC and ctrl Z
 	/*These attr flags are bit flags, '~' is the NOT operator that inverts the bits and '&=' ANDs the negated result with raw, which ensures that
 	all the existing bits are preserved and the bits corresponding to the removed flag are overwritten to 0
@@ -162,66 +553,294 @@ void enableRawMode(){
 	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw)==-1){
 		die("tcsetattr");
 	}
+	// the terminal wraps pasted text in ESC[200~ and ESC[201~
+	write(E.outfd, "\x1b[?2004h", 8);
+}
+
+long long editorMicros(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/** stats **/
+
+// The probes are cheap enough to stay on: a clock read on either side of the path and a
+// counter bump. Only the main thread and the syntax worker holding the rows record,
+// never at the same time, so the counters need no atomics.
+
+long long editorNanos(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// records one pass through a probed path that took ns
+void statAdd(int probe, long long ns){
+	struct statCounter* c = &stats.probe[probe];
+	c->count++;
+	c->total += ns;
+	if (ns > c->max) c->max = ns;
+	int b = 0;
+	while (b < STAT_BUCKETS - 1 && ns >> b) b++;
+	c->hist[b]++;
+}
+
+// upper bound of the bucket the pct-th percentile falls in, ns
+long long statPercentile(struct statCounter* c, int pct){
+	long long want = (c->count * pct + 99) / 100;
+	long long seen = 0;
+	for (int b = 0; b < STAT_BUCKETS - 1; b++){
+		seen += c->hist[b];
+		if (seen >= want) return 1LL << b;
+	}
+	return c->max;
+}
+
+// writes ns the way it reads best, 850ns, 12.3us, 4.1ms or 2.0s
+void statFormat(char* buf, size_t size, long long ns){
+	if (ns < 1000) snprintf(buf, size, "%lldns", ns);
+	else if (ns < 1000000) snprintf(buf, size, "%.1fus", ns / 1e3);
+	else if (ns < 1000000000) snprintf(buf, size, "%.1fms", ns / 1e6);
+	else snprintf(buf, size, "%.1fs", ns / 1e9);
+}
+
+char* statNames[STAT_PROBES] = {"key", "syntax", "render", "draw", "write"};
+
+// One line of the stats overlay or the dump. Line STAT_PROBES is the key latency
+// histogram, the one after it frame and allocation counts.
+#define STAT_LINES (STAT_PROBES + 2)
+
+// screen lines the text gets, the overlay takes the bottom ones while it is up on a
+// screen with room for it
+int editorTextRows(){
+	return stats.shown && E.screenrows > STAT_LINES ? E.screenrows - STAT_LINES : E.screenrows;
+}
+
+int editorStatsLine(char* buf, size_t size, int i){
+	if (i < STAT_PROBES){
+		struct statCounter* c = &stats.probe[i];
+		char total[16], mean[16], p50[16], p99[16], max[16];
+		statFormat(total, sizeof(total), c->total);
+		statFormat(mean, sizeof(mean), c->count ? c->total / c->count : 0);
+		statFormat(p50, sizeof(p50), statPercentile(c, 50));
+		statFormat(p99, sizeof(p99), statPercentile(c, 99));
+		statFormat(max, sizeof(max), c->max);
+		return snprintf(buf, size, "%-6s %9lld  total %8s  mean %8s  p50 <%8s  p99 <%8s  max %8s",
+			statNames[i], c->count, total, mean, p50, p99, max);
+	}
+	if (i == STAT_PROBES){
+		// a column per bucket from 1us up, taller chars for fuller buckets
+		struct statCounter* c = &stats.probe[STAT_KEY];
+		const char* shades = " .:-=+*#%@";
+		long long most = 1;
+		for (int b = 0; b < STAT_BUCKETS; b++) if (c->hist[b] > most) most = c->hist[b];
+		int len = snprintf(buf, size, "key    1us [");
+		for (int b = 10; b < STAT_BUCKETS && len + 1 < (int)size; b++){
+			buf[len++] = shades[c->hist[b] ? 1 + c->hist[b] * 8 / most : 0];
+		}
+		len += snprintf(buf + len, size - len, "] 4s");
+		return len < (int)size ? len : (int)size - 1;
+	}
+	long long keys = stats.probe[STAT_KEY].count ? stats.probe[STAT_KEY].count : 1;
+	long long frames = stats.frames ? stats.frames : 1;
+	return snprintf(buf, size, "frames %lld  %lld bytes each  %d last | allocs %lld, %lld per key",
+		stats.frames, E.total_frame_bytes / frames, E.frame_bytes, alloc_count, alloc_count / keys);
+}
+
+// the frame for the key being handled went out, or turned out not to be needed
+void editorStatsFrame(){
+	if (stats.key_start == 0) return;
+	statAdd(STAT_KEY, editorNanos() - stats.key_start);
+	stats.key_start = 0;
+}
+
+// Writes the counters to the file given with --stats, registered with atexit. Besides
+// the overlay's lines every probe's whole histogram goes in, one bucket per line.
+void editorStatsDump(){
+	FILE* fp = fopen(stats.dump, "w");
+	if (fp == NULL) return;
+	char line[256];
+	for (int i = 0; i < STAT_LINES; i++){
+		editorStatsLine(line, sizeof(line), i);
+		fprintf(fp, "%s\n", line);
+	}
+	for (int i = 0; i < STAT_PROBES; i++){
+		for (int b = 0; b < STAT_BUCKETS; b++){
+			if (stats.probe[i].hist[b]) fprintf(fp, "%s <%lldns %lld\n", statNames[i], 1LL << b, stats.probe[i].hist[b]);
+		}
+	}
+	fclose(fp);
+}
+
+int replayCompare(const void* a, const void* b){
+	long long x = *(const long long*)a;
+	long long y = *(const long long*)b;
+	return (x > y) - (x < y);
+}
+
+// Prints what a replay measured to stderr, registered with atexit so quitting
+// through Ctrl-Q reports too
+void editorReplayReport(){
+	struct editorReplay* r = E.replay;
+	if (r == NULL) return;
+	long long total = editorMicros() - r->start;
+	qsort(r->lat, r->nlat, sizeof(long long), replayCompare);
+
+	long long sum = 0;
+	for (int i = 0; i < r->nlat; i++) sum += r->lat[i];
+	int n = r->nlat ? r->nlat : 1;
+	fprintf(stderr, "keys        %d in %.3fs\n", r->nlat, total / 1e6);
+	fprintf(stderr, "latency us  mean %lld  p50 %lld  p90 %lld  p99 %lld  max %lld\n",
+		sum / n, r->nlat ? r->lat[r->nlat / 2] : 0, r->nlat ? r->lat[r->nlat * 9 / 10] : 0,
+		r->nlat ? r->lat[r->nlat * 99 / 100] : 0, r->nlat ? r->lat[r->nlat - 1] : 0);
+	fprintf(stderr, "rendered    %lld bytes, %lld per key\n", E.total_frame_bytes, E.total_frame_bytes / n);
+	fprintf(stderr, "allocs      %lld (%lld bytes), %lld per key\n", alloc_count, alloc_bytes, alloc_count / n);
+	fprintf(stderr, "row memory  %lld blocks, %lld reused, %lld grown in place, %lld slabs, %lld large\n",
+		rowmem.allocs, rowmem.reused, rowmem.grown_in_place, rowmem.slabs, rowmem.large);
+	fprintf(stderr, "paging      %lld chunks in, %lld spilled (%lld KB scratch), %lld KB of rows\n",
+		E.page.loads, E.page.spills, E.page.scratchlen >> 10, (long long)(E.page.bytes + rowmem.bytes) >> 10);
+	for (int i = STAT_SYNTAX; i < STAT_PROBES; i++){
+		char total[16], p99[16];
+		statFormat(total, sizeof(total), stats.probe[i].total);
+		statFormat(p99, sizeof(p99), statPercentile(&stats.probe[i], 99));
+		fprintf(stderr, "%-11s %lld calls, %s in all, p99 under %s\n", statNames[i], stats.probe[i].count, total, p99);
+	}
+}
+
+// Called when the editor wants a key. Ends the timing of the previous key, and since
+// nothing waits on a script, lets background work finish untimed first.
+void editorReplayWait(){
+	struct editorReplay* r = E.replay;
+	if (r->key_start){
+		if (r->nlat == r->caplat){
+			r->caplat = r->caplat ? r->caplat * 2 : 1024;
+			r->lat = xrealloc(r->lat, sizeof(long long) * r->caplat);
+		}
+		r->lat[r->nlat++] = editorMicros() - r->key_start;
+		r->key_start = 0;
+	}
+	while (editorIdle());
+	while (editorSyntaxWork());
+}
+
+// Reads whatever input is available into the ring, waiting up to timeout ms for it
+// (-1 waits for good). Returns the number of bytes read, 0 on timeout, -1 once the
+// input is closed.
+int editorInputFill(int timeout){
+	struct editorInput* in = &input;
+	unsigned int count = in->tail - in->head;
+	if (count == WYNAUT_INPUT_BUF) return 0;
+
+	struct pollfd pfd = {E.infd, POLLIN, 0};
+	int ready;
+	while ((ready = poll(&pfd, 1, timeout)) == -1){
+		if (errno != EINTR && errno != EAGAIN) die("poll");
+	}
+	if (ready == 0) return 0;
+
+	// the free space may wrap around the end of the ring, one readv fills both parts
+	unsigned int at = in->tail & (WYNAUT_INPUT_BUF - 1);
+	unsigned int space = WYNAUT_INPUT_BUF - count;
+	unsigned int first = WYNAUT_INPUT_BUF - at < space ? WYNAUT_INPUT_BUF - at : space;
+	struct iovec iov[2] = {
+		{in->buf + at, first},
+		{in->buf, space - first}
+	};
+	ssize_t n = readv(E.infd, iov, space > first ? 2 : 1);
+	if (n == -1){
+		if (errno == EINTR || errno == EAGAIN) return 0;
+		die("read");
+	}
+	if (n == 0) return -1;
+	in->tail += n;
+	return n;
+}
+
+// next input byte, or -1 when none arrives within timeout ms or the input is closed
+int editorInputByte(int timeout){
+	struct editorInput* in = &input;
+	if (in->head == in->tail && editorInputFill(timeout) <= 0) return -1;
+	return in->buf[in->head++ & (WYNAUT_INPUT_BUF - 1)];
 }
 
-// Waits for one key press, reads(low-level) it and returns it
-// if esc sequence detected, would read further
+// whether input is waiting, either buffered already or on the terminal
+int editorInputPending(){
+	if (input.head != input.tail) return 1;
+	struct pollfd pfd = {E.infd, POLLIN, 0};
+	return poll(&pfd, 1, 0) > 0;
+}
+
+// Waits for one key press and returns it. Escape sequences are parsed out of the
+// input ring, whatever follows an ESC arrives with it, so a lone ESC is one that
+// isn't followed by anything within WYNAUT_ESC_MS.
 int editorReadKey(){
-	int nread;
-	char c;
-	while((nread = read(STDIN_FILENO,&c,1)) != 1){
-		if (nread == -1 && errno != EAGAIN){
-			die("read");
-		}
-	}
-
-	if (c =='\x1b'){
-		char seq[3];
-
-		if (read(STDIN_FILENO, &seq[0],1) != 1) return'\x1b';
-		if (read(STDIN_FILENO, &seq[1],1) != 1) return'\x1b';
-
-		// Checks for arrow keys
-		// Also checks for other escape sequences such as page up and down
-		if (seq[0] == '['){
-			if (seq[1] >= '0' && seq[1] <= '9'){
-				if (read(STDIN_FILENO, &seq[2],1) != 1) return '\x1b';
-				if (seq[2] == '~'){
-					switch (seq[1]) {
-						case '1': return HOME_KEY;
-						case '3': return DEL_KEY;
-						case '4': return END_KEY;
-						case '5': return PAGE_UP;
-						case '6': return PAGE_DOWN;
-						case '7': return HOME_KEY;
-						case '8': return END_KEY;
-					}
-				}
-			}
-			else{
-				switch(seq[1]){
-					case 'A': return ARROW_UP;
-					case 'B': return ARROW_DOWN;
-					case 'C': return ARROW_RIGHT;
-					case 'D': return ARROW_LEFT;
-					case 'H': return HOME_KEY;
-					case 'F': return END_KEY;
+	if (E.replay){
+		editorReplayWait();
+	}
+	else{
+		// background work runs in slices for as long as no key is waiting, after that
+		// the syntax worker has the rows until one comes in
+		while (!editorInputPending()){
+			if (editorIdle()) continue;
+			if (!editorWaitInput()) editorRefreshScreen();
+		}
+	}
+
+	int c = editorInputByte(-1);
+	// the terminal went away, or the script ran out
+	if (c == -1) exit(0);
+	if (E.replay) E.replay->key_start = editorMicros();
+	stats.key_start = editorNanos();
+
+	if (c != '\x1b') return c;
+
+	int seq0 = editorInputByte(WYNAUT_ESC_MS);
+	int seq1 = editorInputByte(WYNAUT_ESC_MS);
+	if (seq0 == -1 || seq1 == -1) return '\x1b';
+
+	// Checks for arrow keys
+	// Also checks for other escape sequences such as page up and down
+	if (seq0 == '['){
+		if (seq1 >= '0' && seq1 <= '9'){
+			// numbered keys end with ~, bracketed paste uses 200 and 201
+			int num = seq1 - '0';
+			int d;
+			while ((d = editorInputByte(WYNAUT_ESC_MS)) >= '0' && d <= '9' && num < 1000) num = num * 10 + d - '0';
+			if (d == '~'){
+				switch (num) {
+					case 1: return HOME_KEY;
+					case 3: return DEL_KEY;
+					case 4: return END_KEY;
+					case 5: return PAGE_UP;
+					case 6: return PAGE_DOWN;
+					case 7: return HOME_KEY;
+					case 8: return END_KEY;
+					case 200: return PASTE_START;
+					case 201: return PASTE_END;
 				}
 			}
 		}
-		// Sometimes Home and End keys might return <esc>OH/F
-		else if (seq[0] == 'O'){
-			switch (seq[1]) {
+		else{
+			switch(seq1){
+				case 'A': return ARROW_UP;
+				case 'B': return ARROW_DOWN;
+				case 'C': return ARROW_RIGHT;
+				case 'D': return ARROW_LEFT;
 				case 'H': return HOME_KEY;
 				case 'F': return END_KEY;
 			}
 		}
-
-		return '\x1b';
 	}
-	else{
-		return c;
+	// Sometimes Home and End keys might return <esc>OH/F
+	else if (seq0 == 'O'){
+		switch (seq1) {
+			case 'H': return HOME_KEY;
+			case 'F': return END_KEY;
+		}
 	}
+
+	return '\x1b';
 }
 
 //returns the position of the cursor
@@ -260,465 +879,4300 @@ int getWindowsSize(int* rows, int* cols){
 	}
 }
 
-/** syntax highlighting **/
+/** row memory **/
 
-// Checks chars against hardcoded list of separators
-int is_separator(int c){
-	// strchr returns null if it doesnt find any of these chars in c
-	return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
-}
+// Row text, render and hl come from size classed slabs rather than a malloc each.
+// Every class keeps a free list that freed blocks go back on, and carves new blocks
+// out of a WYNAUT_SLAB sized slab when the list is empty. Blocks are handed out at
+// their class size, so a row can grow a little without moving. Anything above the
+// largest class goes to malloc with a quarter extra. Only the main thread allocates.
 
+// smallest class that fits size, -1 when none does
+int rowmemClassOf(int size){
+	for (int i = 0; i < ROWMEM_CLASSES; i++){
+		if (rowmemSizes[i] >= size) return i;
+	}
+	return -1;
+}
 
-void editorUpdateSyntax(erow* row){
-	row->hl = realloc(row->hl, row->rsize);
-	//set all characters to HL_NORMAL by default
-	memset(row->hl, HL_NORMAL, row->rsize);
+// returns at least size bytes, the usable size goes to *cap
+char* rowmemAlloc(int size, int* cap){
+	rowmem.allocs++;
+	int c = rowmemClassOf(size);
+	if (c == -1){
+		*cap = size + size / 4;
+		rowmem.large++;
+		rowmem.bytes += *cap;
+		return xmalloc(*cap);
+	}
 
-	if (E.syntax == NULL) return;	
+	*cap = rowmemSizes[c];
+	rowmem.bytes += *cap;
+	char* p = rowmem.freelist[c];
+	if (p){
+		rowmem.freelist[c] = *(char**)p;
+		rowmem.reused++;
+		return p;
+	}
+	if (rowmem.slab[c] == NULL || rowmem.slab_end[c] - rowmem.slab[c] < *cap){
+		rowmem.slab[c] = xmalloc(WYNAUT_SLAB);
+		rowmem.slab_end[c] = rowmem.slab[c] + WYNAUT_SLAB;
+		rowmem.slabs++;
+	}
+	p = rowmem.slab[c];
+	rowmem.slab[c] += *cap;
+	return p;
+}
 
-	char** keywords = E.syntax->keywords;
+// gives a block back, cap is what rowmemAlloc reported
+void rowmemFree(char* p, int cap){
+	if (p == NULL) return;
+	rowmem.bytes -= cap;
+	int c = rowmemClassOf(cap);
+	if (c == -1 || rowmemSizes[c] != cap){
+		free(p);
+		return;
+	}
+	*(char**)p = rowmem.freelist[c];
+	rowmem.freelist[c] = p;
+}
 
-	char *scs = E.syntax->singleline_comment_start;
-	int scs_len = scs ? strlen(scs) : 0;
+// makes room for need bytes, keeping the first len. Stays put while the slack lasts.
+char* rowmemGrow(char* p, int len, int* cap, int need){
+	if (need <= *cap){
+		rowmem.grown_in_place++;
+		return p;
+	}
+	int newcap;
+	char* q = rowmemAlloc(need, &newcap);
+	memcpy(q, p, len);
+	rowmemFree(p, *cap);
+	*cap = newcap;
+	return q;
+}
 
-	int prev_sep = 1;
-	int in_string = 0;
-	
-	// now we loop over the digits and change the digits to HL_NUMBER
-	int i = 0;
-	while (i < row->rsize){
-		char c = row->render[i];
-		unsigned char prev_hl = (i > 0) ? row->hl[i-1] : HL_NORMAL;
+/** row storage **/
 
-		if (scs_len && !in_string) {
-			if (!strncmp(&row->render[i], scs, scs_len)){ // checks if current char is part of the commentstart
-				memset(&row->hl[i], HL_COMMENT, row->rsize - i); // sets entire line to comment color
-				break;
-			}
-		}
-		
-		// if the highlight string flag is raised
-		if (E.syntax->flags & HL_HIGHLIGHT_STRINGS){
-			// and the character is in a string
-			if (in_string) {
-				row->hl[i] = HL_STRING;//color it
-				// exempting escaped chars from making a difference to color
-				if (c == '\\' && i + 1 < row->rsize){
-					row->hl[i+1] = HL_STRING;
-					i += 2;
-					continue;
-				}
-				if ( c == in_string) in_string = 0;//if the char happens to be the matching quote, stop coloring
-				i++;
-				prev_sep = 1; // set it so digits are not exempted
-				continue;
-			}
-			else {
-				// if char is not in a str, but is an quote mark
-				// color it like a str and set in string to it
-				if (c=='"' || c == '\''){
-					in_string = c;
-					row->hl[i] = HL_STRING;
-					i++;
-					continue;
-				}
-			}
-		}
+unsigned int rowChunkRand(){
+	static unsigned int seed = 2463534242u;
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
 
-		if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS){
-			if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) || (c == '.' && prev_hl == HL_NUMBER)){
-				row->hl[i] = HL_NUMBER;
-				i++;
-				prev_sep = 0;
-				continue;
-			}
-		}
+// a chunk that is paged out, src has to be filled in
+rowchunk* rowChunkStub(){
+	rowchunk* c = xmalloc(sizeof(rowchunk));
+	c->left = c->right = NULL;
+	c->prio = rowChunkRand();
+	c->chunks = 1;
+	c->lines = 0;
+	c->n = 0;
+	c->rows = NULL;
+	c->src = 0;
+	c->srclen = 0;
+	c->buf = NULL;
+	c->used = 0;
+	c->hl_end = 0;
+	c->flags = 0;
+	return c;
+}
 
-		if (prev_sep){
-			int j;
-			for (j=0; keywords[j]; j++){
-				int klen = strlen(keywords[j]);
-				int kw2 = keywords[j][klen-1] == '|';
-				if (kw2) klen --;
+// a chunk paged in, with no copy of its rows anywhere yet
+rowchunk* rowChunkNew(){
+	rowchunk* c = rowChunkStub();
+	c->rows = xmalloc(sizeof(erow) * WYNAUT_ROW_CHUNK);
+	c->flags = CHUNK_MODIFIED;
+	E.page.bytes += sizeof(erow) * WYNAUT_ROW_CHUNK;
+	return c;
+}
 
-				if (!strncmp(&row->render[i], keywords[j], klen) &&
-						is_separator(row->render[i + klen])) {
-					memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
-					i += klen;
-					break;
-				}
-			}
+void rowChunkDropBuf(rowchunk* c){
+	if (c->buf == NULL) return;
+	E.page.bytes -= c->srclen;
+	// a running save may be writing rows that borrow from it
+	if (E.saving) editorSaveDefer(c->buf, -1);
+	else free(c->buf);
+	c->buf = NULL;
+}
 
-			if (keywords[j] != NULL) {
-				prev_sep = 0;
-				continue;
-			}
-		}
-		prev_sep = is_separator(c);
-		i++;
+void rowChunkFree(rowchunk* c){
+	if (c->rows){
+		free(c->rows);
+		E.page.bytes -= sizeof(erow) * WYNAUT_ROW_CHUNK;
 	}
+	rowChunkDropBuf(c);
+	free(c);
 }
 
-int editorSyntaxToColor(int hl){
-	switch(hl){
-		case HL_COMMENT:
-			return 36;
-		case HL_KEYWORD1:
-			return 33;
-		case HL_KEYWORD2:
-			return 32;
-		case HL_STRING:
-			return 35;
-		case HL_NUMBER:
-			return 31;
-		case HL_MATCH:
-			return 34;
-		default:
-			return 37;
+// recomputes the subtree counts of a node from its children
+void rowChunkPull(rowchunk* c){
+	c->chunks = 1;
+	c->lines = c->n;
+	if (c->left){
+		c->chunks += c->left->chunks;
+		c->lines += c->left->lines;
+	}
+	if (c->right){
+		c->chunks += c->right->chunks;
+		c->lines += c->right->lines;
 	}
 }
 
-void editorSelectSyntaxHighlight(){
-	E.syntax = NULL;
-	if (E.filename == NULL) return;
-	
-	//returns the text after the '.'
-	char* ext = strrchr(E.filename, '.');
+// splits t so that the first k chunks end up in *a and the rest in *b
+void rowChunkSplit(rowchunk* t, int k, rowchunk** a, rowchunk** b){
+	if (t == NULL){
+		*a = *b = NULL;
+		return;
+	}
+	int lc = t->left ? t->left->chunks : 0;
+	if (k <= lc){
+		rowChunkSplit(t->left, k, a, &t->left);
+		rowChunkPull(t);
+		*b = t;
+	}
+	else{
+		rowChunkSplit(t->right, k - lc - 1, &t->right, b);
+		rowChunkPull(t);
+		*a = t;
+	}
+}
 
-	for (unsigned int j=0; j< HLDB_ENTRIES; j++){
-		struct editorSyntax* s = &HLDB[j];
-		unsigned int i = 0;
-		while (s->filematch[i]) {
-			int is_ext = (s->filematch[i][0] == '.');
-			if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
-				(!is_ext && strstr(E.filename, s->filematch[i]))) {
-			  E.syntax = s;
+// joins two treaps, every chunk of a comes before every chunk of b
+rowchunk* rowChunkMerge(rowchunk* a, rowchunk* b){
+	if (a == NULL) return b;
+	if (b == NULL) return a;
+	if (a->prio > b->prio){
+		a->right = rowChunkMerge(a->right, b);
+		rowChunkPull(a);
+		return a;
+	}
+	b->left = rowChunkMerge(a, b->left);
+	rowChunkPull(b);
+	return b;
+}
 
-			  int filerow;
-			  for (filerow = 0; filerow < E.numrows; filerow++) {
-				editorUpdateSyntax(&E.row[filerow]);
-			  }
-			  return;
-			}
-			i++;
+#define ROW_TREE_DEPTH 128
+
+// Finds the chunk holding row `at`. at == E.numrows resolves to the end of the last chunk.
+// Fills *local with the index inside the chunk and *ci with the chunk's position.
+// If path is not NULL it receives the nodes walked through (root first), *depth their count.
+// Chunks that are paged out stay out, see rowChunkFind.
+rowchunk* rowChunkLocate(int at, int* local, int* ci, rowchunk** path, int* depth){
+	rowchunk* t = E.rows;
+	int d = 0;
+	int chunks = 0;
+	while (t){
+		if (path && d < ROW_TREE_DEPTH) path[d++] = t;
+		int ll = t->left ? t->left->lines : 0;
+		int lc = t->left ? t->left->chunks : 0;
+		if (at < ll){
+			t = t->left;
+		}
+		else if (at - ll < t->n || (at - ll == t->n && t->right == NULL)){
+			*local = at - ll;
+			*ci = chunks + lc;
+			if (depth) *depth = d;
+			return t;
+		}
+		else{
+			at -= ll + t->n;
+			chunks += lc + 1;
+			t = t->right;
 		}
 	}
+	return NULL;
 }
 
-/** row operations **/
+// rowChunkLocate for a chunk whose rows are about to be used, it is paged in if it was out
+rowchunk* rowChunkFind(int at, int* local, int* ci, rowchunk** path, int* depth){
+	rowchunk* c = rowChunkLocate(at, local, ci, path, depth);
+	if (c && c->rows == NULL){
+		// paging it in reshapes the tree, so the walk is done again
+		rowChunkLoad(c, *ci);
+		c = rowChunkLocate(at, local, ci, path, depth);
+	}
+	if (c) c->used = ++E.page.clock;
+	return c;
+}
 
-int editorRowCxToRx(erow* row, int cx){
-	int rx = 0;
-	for (int j=0; j<cx;j++){
-		if (row->chars[j] == '\t')
-			rx += (WYNAUT_TAB_STOP-1) - (rx % WYNAUT_TAB_STOP);
-		rx++;
+// returns the k-th chunk in order, paged out or not
+rowchunk* rowChunkNth(int k){
+	rowchunk* t = E.rows;
+	while (t){
+		int lc = t->left ? t->left->chunks : 0;
+		if (k < lc) t = t->left;
+		else if (k == lc) return t;
+		else{
+			k -= lc + 1;
+			t = t->right;
+		}
 	}
-	return rx;
+	return NULL;
 }
 
-int editorRowRxToCx(erow* row, int rx){
-	int cur_rx = 0;
-	int cx;
-	for (cx = 0; cx < row->size; cx++){
-		if (row->chars[cx] == '\t'){
-			cur_rx += (WYNAUT_TAB_STOP - 1) - (cur_rx % WYNAUT_TAB_STOP);
+// the k-th chunk, paged in if it was out
+rowchunk* rowChunkGet(int k){
+	rowchunk* c = rowChunkNth(k);
+	if (c && c->rows == NULL) c = rowChunkLoad(c, k);
+	if (c) c->used = ++E.page.clock;
+	return c;
+}
+
+// returns the row at a given position, NULL when out of range
+erow* editorRowAt(int at){
+	if (at < 0 || at >= E.numrows) return NULL;
+	int local, ci;
+	rowchunk* c = rowChunkFind(at, &local, &ci, NULL, NULL);
+	return &c->rows[local];
+}
+
+// inserts a copy of *row at position at, shifting later rows down
+void editorRowsInsert(int at, erow* row){
+	if (E.rows == NULL) E.rows = rowChunkNew();
+
+	rowchunk* path[ROW_TREE_DEPTH];
+	int depth, local, ci;
+	rowchunk* c = rowChunkFind(at, &local, &ci, path, &depth);
+
+	if (c->n == WYNAUT_ROW_CHUNK){
+		// full chunk: move its upper half into a new chunk right after it and retry
+		rowchunk* split = rowChunkNew();
+		int half = WYNAUT_ROW_CHUNK / 2;
+		memcpy(split->rows, &c->rows[half], sizeof(erow) * (c->n - half));
+		split->n = c->n - half;
+		c->n = half;
+		c->flags |= CHUNK_MODIFIED;
+		// c's buffer goes when c is paged out, the rows moving away can't keep borrowing from it
+		for (int i = 0; c->buf && i < split->n; i++){
+			if (split->rows[i].flags & ROW_MAPPED) editorRowDetach(&split->rows[i]);
 		}
-		cur_rx++;
+		for (int d = depth - 1; d >= 0; d--) rowChunkPull(path[d]);
+		rowChunkPull(split);
 
-		if (cur_rx > rx) return cx;
+		rowchunk *a, *b;
+		rowChunkSplit(E.rows, ci + 1, &a, &b);
+		E.rows = rowChunkMerge(rowChunkMerge(a, split), b);
+		c = rowChunkFind(at, &local, &ci, path, &depth);
 	}
-	return cx;
+
+	memmove(&c->rows[local + 1], &c->rows[local], sizeof(erow) * (c->n - local));
+	c->rows[local] = *row;
+	c->n++;
+	c->flags |= CHUNK_MODIFIED;
+	for (int d = 0; d < depth; d++) path[d]->lines++;
+	E.numrows++;
 }
 
-void editorUpdateRow(erow* row){
-	int tabs = 0;
-	for (int i =0; i<row->size;i++){
-		if (row->chars[i] == '\t') tabs++;
+// removes the row at position at, the caller owns whatever it pointed to
+void editorRowsRemove(int at){
+	rowchunk* path[ROW_TREE_DEPTH];
+	int depth, local, ci;
+	rowchunk* c = rowChunkFind(at, &local, &ci, path, &depth);
+
+	memmove(&c->rows[local], &c->rows[local + 1], sizeof(erow) * (c->n - local - 1));
+	c->n--;
+	c->flags |= CHUNK_MODIFIED;
+	for (int d = 0; d < depth; d++) path[d]->lines--;
+	E.numrows--;
+
+	if (c->n == 0 && E.rows->chunks > 1){
+		rowchunk *a, *b, *mid;
+		rowChunkSplit(E.rows, ci, &a, &b);
+		rowChunkSplit(b, 1, &mid, &b);
+		E.rows = rowChunkMerge(a, b);
+		rowChunkFree(mid);
+	}
+}
+
+// Walks rows in order, much cheaper than calling editorRowAt for each one
+struct rowiter {
+	rowchunk* c;
+	int ci;
+	int i;
+};
+
+void editorRowIterInit(struct rowiter* it, int at){
+	it->c = NULL;
+	if (at < 0 || at >= E.numrows) return;
+	it->c = rowChunkFind(at, &it->i, &it->ci, NULL, NULL);
+}
+
+erow* editorRowIterNext(struct rowiter* it){
+	while (it->c && it->i >= it->c->n){
+		it->c = rowChunkGet(++it->ci);
+		it->i = 0;
 	}
+	if (it->c == NULL) return NULL;
+	return &it->c->rows[it->i++];
+}
 
-	free(row->render);
-	row->render = malloc(row->size + tabs*(WYNAUT_TAB_STOP-1) + 1);
+/** syntax highlighting **/
+
+// Checks chars against hardcoded list of separators
+int is_separator(int c){
+	// strchr returns null if it doesnt find any of these chars in c
+	return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+}
+
+
+// Builds the trie for a list of words. hl gives each word's highlight, or is NULL for a
+// keyword list where words ending in '|' are keyword2. sep is kept in the matcher.
+struct keywordMatcher* keywordCompileAs(char** keywords, const unsigned char* hl, int sep){
+	struct keywordMatcher* km = xcalloc(1, sizeof(struct keywordMatcher));
+	km->sep = sep;
+	int maxstates = 2;
+	km->nclasses = 1;
+	for (int j = 0; keywords[j]; j++){
+		for (char* c = keywords[j]; *c; c++){
+			unsigned char b = *c;
+			if (km->cls[b] == 0) km->cls[b] = km->nclasses++;
+		}
+		maxstates += strlen(keywords[j]);
+	}
+
+	km->next = xcalloc(maxstates * km->nclasses, sizeof(int));
+	km->hl = xcalloc(maxstates, 1);
+	km->rank = xcalloc(maxstates, sizeof(int));
+	int nstates = 2;
+
+	for (int j = 0; keywords[j]; j++){
+		int klen = strlen(keywords[j]);
+		int kw2 = hl == NULL && klen > 0 && keywords[j][klen-1] == '|';
+		if (kw2) klen--;
+		if (klen == 0) continue;
+
+		int state = 1;
+		for (int k = 0; k < klen; k++){
+			int* t = &km->next[state * km->nclasses + km->cls[(unsigned char)keywords[j][k]]];
+			if (*t == 0) *t = nstates++;
+			state = *t;
+		}
+		// a duplicate keeps the class of its first occurrence
+		if (km->hl[state] == HL_NORMAL){
+			km->hl[state] = hl ? hl[j] : kw2 ? HL_KEYWORD2 : HL_KEYWORD1;
+			km->rank[state] = j;
+		}
+	}
+	return km;
+}
+
+struct keywordMatcher* keywordCompile(char** keywords){
+	return keywordCompileAs(keywords, NULL, 1);
+}
+
+// whether some word of the trie starts with byte b
+int keywordStarts(struct keywordMatcher* km, unsigned char b){
+	return km && km->next[km->nclasses + km->cls[b]] != 0;
+}
+
+// Returns the length of the keyword at the start of s (len bytes available) that is
+// followed by a separator, 0 if there is none. Walks the text once, when several
+// keywords qualify the one listed first wins, same as scanning the list in order.
+int keywordMatch(struct keywordMatcher* km, const char* s, int len, unsigned char* hl){
+	int state = 1;
+	int best = 0, bestrank = INT_MAX;
+	for (int k = 0; k < len;){
+		state = km->next[state * km->nclasses + km->cls[(unsigned char)s[k]]];
+		if (state == 0) break;
+		k++;
+		if (km->hl[state] != HL_NORMAL && km->rank[state] < bestrank &&
+				(k == len || !km->sep || is_separator(s[k]))){
+			best = k;
+			bestrank = km->rank[state];
+			*hl = km->hl[state];
+		}
+	}
+	return best;
+}
+
+// Compiles a syntax into its lexer tables. Each step does what editorHighlightLine's rules
+// say for one byte in one mode, the rules that look further ahead than a byte (comment
+// markers, keywords) are left to the tries and marked in token where they could apply.
+struct syntaxLexer* syntaxCompile(struct editorSyntax* s){
+	struct syntaxLexer* lx = xcalloc(1, sizeof(struct syntaxLexer));
+	char* scs = s->singleline_comment_start;
+	char* mcs = s->multiline_comment_start;
+	char* mce = s->multiline_comment_end;
+	if (scs && !*scs) scs = NULL;
+	// a multi-line comment needs both markers
+	int ml = mcs && *mcs && mce && *mce;
+
+	// the single-line marker wins when both could start at the same byte
+	char* open[3];
+	unsigned char openhl[2];
+	int n = 0;
+	if (scs){
+		open[n] = scs;
+		openhl[n++] = HL_COMMENT;
+	}
+	if (ml){
+		open[n] = mcs;
+		openhl[n++] = HL_MLCOMMENT;
+	}
+	open[n] = NULL;
+	if (n) lx->open = keywordCompileAs(open, openhl, 0);
+	if (ml){
+		char* close[2] = {mce, NULL};
+		unsigned char closehl = HL_MLCOMMENT;
+		lx->close = keywordCompileAs(close, &closehl, 0);
+		lx->closefirst = mce[0];
+	}
+	lx->kw = keywordCompile(s->keywords);
+
+	int strings = s->flags & HL_HIGHLIGHT_STRINGS;
+	int numbers = s->flags & HL_HIGHLIGHT_NUMBERS;
+	for (int mode = 0; mode < LEX_MODES; mode++){
+		for (int b = 0; b < 256; b++){
+			struct lexStep* st = &lx->step[mode][b];
+			if (mode <= LEX_NUM){
+				int digit = b >= '0' && b <= '9';
+				if (keywordStarts(lx->open, b)) st->token |= LEX_MARKER;
+				if (strings && (b == '"' || b == '\'')){
+					st->hl = HL_STRING;
+					st->next = b == '"' ? LEX_DQUOTE : LEX_SQUOTE;
+				}
+				else if (numbers && ((digit && mode != LEX_WORD) || (b == '.' && mode == LEX_NUM))){
+					st->hl = HL_NUMBER;
+					st->next = LEX_NUM;
+				}
+				else{
+					st->hl = HL_NORMAL;
+					st->next = is_separator((char)b) ? LEX_SEP : LEX_WORD;
+					// keywords only start after a separator, and after quotes and digits had their turn
+					if (mode == LEX_SEP && keywordStarts(lx->kw, b)) st->token |= LEX_KEYWORD;
+				}
+			}
+			else if (mode == LEX_COMMENT){
+				st->hl = HL_MLCOMMENT;
+				st->next = LEX_COMMENT;
+				if (keywordStarts(lx->close, b)) st->token |= LEX_MARKER;
+			}
+			else{
+				// the byte after a backslash is part of the string whatever it is
+				int open = mode < LEX_SQUOTE ? LEX_DQUOTE : LEX_SQUOTE;
+				int quote = open == LEX_DQUOTE ? '"' : '\'';
+				st->hl = HL_STRING;
+				if (mode != open) st->next = open;
+				else if (b == '\\') st->next = open + 1;
+				else if (b == quote) st->next = LEX_SEP;
+				else st->next = open;
+			}
+		}
+	}
+	return lx;
+}
+
+// Highlights len bytes of text into hl. open_comment is the state the previous row
+// ended in, the state at the end of this text is returned. One lookup per byte in the
+// syntax's step table, with a trie walk where a marker or keyword may start.
+int editorHighlightLine(const char* text, int len, unsigned char* hl, int open_comment){
+	if (E.syntax == NULL){
+		memset(hl, HL_NORMAL, len);
+		return 0;
+	}
+	struct syntaxLexer* lx = E.syntax->lexer;
+	int mode = open_comment && lx->close ? LEX_COMMENT : LEX_SEP;
+	int i = 0;
+	while (i < len){
+		if (mode == LEX_COMMENT){
+			// nothing but the end marker matters in a comment, jump to where it could start
+			const char* end = memchr(&text[i], lx->closefirst, len - i);
+			int k = end ? end - text : len;
+			memset(&hl[i], HL_MLCOMMENT, k - i);
+			i = k;
+			if (i == len) break;
+		}
+		const struct lexStep* st = &lx->step[mode][(unsigned char)text[i]];
+		if (st->token){
+			unsigned char thl;
+			int n = 0;
+			if (st->token & LEX_MARKER) n = keywordMatch(mode == LEX_COMMENT ? lx->close : lx->open, &text[i], len - i, &thl);
+			if (n && thl == HL_COMMENT){
+				// a single-line comment takes the rest of the row
+				memset(&hl[i], HL_COMMENT, len - i);
+				return 0;
+			}
+			if (n){
+				memset(&hl[i], HL_MLCOMMENT, n);
+				i += n;
+				mode = mode == LEX_COMMENT ? LEX_SEP : LEX_COMMENT;
+				continue;
+			}
+			if ((st->token & LEX_KEYWORD) && (n = keywordMatch(lx->kw, &text[i], len - i, &thl))){
+				memset(&hl[i], thl, n);
+				i += n;
+				mode = LEX_WORD;
+				continue;
+			}
+		}
+		hl[i++] = st->hl;
+		mode = st->next;
+	}
+	return mode == LEX_COMMENT;
+}
+
+// highlights a row's render, returns the comment state the row ends in
+int editorUpdateSyntax(erow* row, int open_comment){
+	return editorHighlightLine(row->render, row->rsize, row->hl, open_comment);
+}
+
+// whether rows carry state into the next one, otherwise every row starts fresh
+int editorSyntaxHasState(){
+	return E.syntax && E.syntax->multiline_comment_start && E.syntax->multiline_comment_end;
+}
+
+// The comment state of rows lo..hi-1 has to be recomputed. Nothing is done right away,
+// the work happens in editorSyntaxCatchUp when a row after them is prepared.
+void editorSyntaxInvalidate(int lo, int hi){
+	if (E.syn_lo >= E.syn_hi){
+		E.syn_lo = lo;
+		E.syn_hi = hi;
+		return;
+	}
+	if (lo < E.syn_lo) E.syn_lo = lo;
+	if (hi > E.syn_hi) E.syn_hi = hi;
+}
+
+// keeps the dirty range pointing at the same rows when a row is inserted or deleted at `at`
+void editorSyntaxShift(int at, int delta){
+	if (E.syn_lo >= E.syn_hi) return;
+	if (E.syn_lo > at) E.syn_lo += delta;
+	if (E.syn_hi > at) E.syn_hi += delta;
+}
+
+// the state the row at `at` starts in
+int editorRowInState(int at){
+	if (at <= 0 || !editorSyntaxHasState()) return 0;
+	return editorRowAt(at - 1)->hl_open_comment;
+}
+
+// whether the comment state of the row at `at` is too far from known to work out on the spot
+int editorSyntaxBehind(int at){
+	return editorSyntaxHasState() && E.syn_lo < E.syn_hi && E.syn_lo <= at &&
+		at - E.syn_lo >= WYNAUT_HL_SYNC;
+}
+
+// The comment state a line ends in, worked out the way editorHighlightLine does but
+// looking only at quotes and comment markers. Numbers and keywords never contain those,
+// so stepping over them one char at a time comes to the same thing.
+int editorSyntaxLex(const char* s, int len, int in){
+	if (!editorSyntaxHasState()) return 0;
+	char* scs = E.syntax->singleline_comment_start;
+	char* mcs = E.syntax->multiline_comment_start;
+	char* mce = E.syntax->multiline_comment_end;
+	int scs_len = scs ? strlen(scs) : 0;
+	int mcs_len = strlen(mcs);
+	int mce_len = strlen(mce);
+	int strings = E.syntax->flags & HL_HIGHLIGHT_STRINGS;
+
+	int in_string = 0;
+	int i = 0;
+	while (i < len){
+		if (in){
+			// only the end marker matters in a comment, jump to where it could start
+			const char* e = len - i >= mce_len ? memchr(&s[i], mce[0], len - i - mce_len + 1) : NULL;
+			if (e == NULL) return 1;
+			i = e - s;
+			if (!memcmp(e, mce, mce_len)){
+				i += mce_len;
+				in = 0;
+			}
+			else{
+				i++;
+			}
+			continue;
+		}
+		char c = s[i];
+		if (in_string){
+			if (c == '\\' && i + 1 < len){
+				i += 2;
+				continue;
+			}
+			if (c == in_string) in_string = 0;
+			i++;
+			continue;
+		}
+		if (scs_len && len - i >= scs_len && !memcmp(&s[i], scs, scs_len)) return 0;
+		if (len - i >= mcs_len && !memcmp(&s[i], mcs, mcs_len)){
+			i += mcs_len;
+			in = 1;
+			continue;
+		}
+		if (strings && (c == '"' || c == '\'')) in_string = c;
+		i++;
+	}
+	return in;
+}
+
+// Recomputes the comment state of dirty rows before `upto`, walking forward from the
+// first dirty row. A row whose end state comes out unchanged stops the walk once the
+// dirty range is used up, so an edit only costs the rows its state actually reaches.
+void editorSyntaxCatchUp(int upto){
+	if (E.syn_lo >= E.syn_hi || E.syn_lo >= upto) return;
+	if (!editorSyntaxHasState()){
+		E.syn_lo = E.syn_hi = 0;
+		return;
+	}
+
+	int in = editorRowInState(E.syn_lo);
+	struct rowiter it;
+	erow* row;
+	editorRowIterInit(&it, E.syn_lo);
+	while (E.syn_lo < E.syn_hi && E.syn_lo < upto && (row = editorRowIterNext(&it))){
+		// the state doesn't depend on tabs, so chars can be lexed without building render
+		int out = editorSyntaxLex(row->chars, row->size, in);
+		row->flags |= ROW_STALE; // its cached hl may have been built from an old state
+		if (out != row->hl_open_comment){
+			row->hl_open_comment = out;
+			// the next row starts in a different state, so it needs a pass too
+			if (E.syn_hi < E.syn_lo + 2) E.syn_hi = E.syn_lo + 2;
+		}
+		in = out;
+		E.syn_lo++;
+	}
+	if (E.syn_lo >= E.syn_hi || E.syn_lo >= E.numrows) E.syn_lo = E.syn_hi = 0;
+}
+
+int editorSyntaxToColor(int hl){
+	switch(hl){
+		case HL_COMMENT:
+		case HL_MLCOMMENT:
+			return 36;
+		case HL_KEYWORD1:
+			return 33;
+		case HL_KEYWORD2:
+			return 32;
+		case HL_STRING:
+			return 35;
+		case HL_NUMBER:
+			return 31;
+		case HL_MATCH:
+			return 34;
+		default:
+			return 37;
+	}
+}
+
+void editorSelectSyntaxHighlight(){
+	if (E.syntax != NULL){
+		E.hlgen++;
+		editorSyntaxInvalidate(0, E.numrows);
+	}
+	E.syntax = NULL;
+	if (E.filename == NULL) return;
+	
+	//returns the text after the '.'
+	char* ext = strrchr(E.filename, '.');
+
+	// definitions from files come first, so they can replace the built in one
+	for (int j=0; j< nsyntaxFiles + (int)HLDB_ENTRIES; j++){
+		struct editorSyntax* s = j < nsyntaxFiles ? syntaxFiles[j] : &HLDB[j - nsyntaxFiles];
+		unsigned int i = 0;
+		while (s->filematch[i]) {
+			int is_ext = (s->filematch[i][0] == '.');
+			if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
+				(!is_ext && strstr(E.filename, s->filematch[i]))) {
+			  E.syntax = s;
+			  if (s->lexer == NULL) s->lexer = syntaxCompile(s);
+			  E.hlgen++; // rows get rehighlighted when they are next shown
+			  editorSyntaxInvalidate(0, E.numrows);
+			  return;
+			}
+			i++;
+		}
+	}
+}
+
+// appends word to a NULL terminated list
+char** syntaxListAdd(char** list, int* n, char* word){
+	list = xrealloc(list, sizeof(char*) * (*n + 2));
+	list[(*n)++] = xstrdup(word);
+	list[*n] = NULL;
+	return list;
+}
+
+// Reads one syntax definition. Each line is a directive followed by its words:
+//   filetype python
+//   match .py .pyw
+//   keywords if else def      (types ... for the second keyword color)
+//   comment #                 (comment_start/comment_end for multi-line ones)
+//   strings                   (numbers)
+// Lines starting with '#' and unknown directives are skipped. Returns NULL if the file
+// can't be read or doesn't say both what it is and which files it is for.
+struct editorSyntax* syntaxReadFile(const char* path){
+	FILE* fp = fopen(path, "r");
+	if (!fp) return NULL;
+	struct editorSyntax* s = xcalloc(1, sizeof(struct editorSyntax));
+	int nmatch = 0, nkw = 0;
+	s->keywords = xcalloc(1, sizeof(char*));
+	char* line = NULL;
+	size_t cap = 0;
+	while (xgetline(&line, &cap, fp) != -1){
+		char* dir = strtok(line, " \t\r\n");
+		if (dir == NULL || dir[0] == '#') continue;
+		char* arg = strtok(NULL, " \t\r\n");
+		int types = !strcmp(dir, "types");
+		if (!strcmp(dir, "strings")) s->flags |= HL_HIGHLIGHT_STRINGS;
+		else if (!strcmp(dir, "numbers")) s->flags |= HL_HIGHLIGHT_NUMBERS;
+		else if (arg == NULL) continue;
+		else if (!strcmp(dir, "filetype")){
+			free(s->filetype);
+			s->filetype = xstrdup(arg);
+		}
+		else if (!strcmp(dir, "comment")){
+			free(s->singleline_comment_start);
+			s->singleline_comment_start = xstrdup(arg);
+		}
+		else if (!strcmp(dir, "comment_start")){
+			free(s->multiline_comment_start);
+			s->multiline_comment_start = xstrdup(arg);
+		}
+		else if (!strcmp(dir, "comment_end")){
+			free(s->multiline_comment_end);
+			s->multiline_comment_end = xstrdup(arg);
+		}
+		else if (!strcmp(dir, "match")){
+			for (; arg; arg = strtok(NULL, " \t\r\n")) s->filematch = syntaxListAdd(s->filematch, &nmatch, arg);
+		}
+		else if (types || !strcmp(dir, "keywords")){
+			// the built in lists mark the second keyword color with a trailing '|'
+			char word[256];
+			for (; arg; arg = strtok(NULL, " \t\r\n")){
+				snprintf(word, sizeof(word), "%s%s", arg, types ? "|" : "");
+				s->keywords = syntaxListAdd(s->keywords, &nkw, word);
+			}
+		}
+	}
+	free(line);
+	fclose(fp);
+	if (s->filetype && s->filematch) return s;
+	free(s->filetype);
+	free(s->singleline_comment_start);
+	free(s->multiline_comment_start);
+	free(s->multiline_comment_end);
+	for (int i = 0; i < nmatch; i++) free(s->filematch[i]);
+	for (int i = 0; i < nkw; i++) free(s->keywords[i]);
+	free(s->filematch);
+	free(s->keywords);
+	free(s);
+	return NULL;
+}
+
+int syntaxNameCmp(const void* a, const void* b){
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Loads the *.syntax files of $WYNAUT_SYNTAX, or of ~/.config/wynaut/syntax, in name
+// order. Only the definitions are read here, their tables get compiled the first time
+// a file uses them.
+void editorSyntaxLoad(){
+	char path[PATH_MAX];
+	char* dir = getenv("WYNAUT_SYNTAX");
+	if (dir == NULL){
+		char* home = getenv("HOME");
+		if (home == NULL) return;
+		snprintf(path, sizeof(path), "%s/.config/wynaut/syntax", home);
+		dir = path;
+	}
+	DIR* d = opendir(dir);
+	if (d == NULL) return;
+	char** names = NULL;
+	int n = 0;
+	struct dirent* ent;
+	while ((ent = readdir(d)) != NULL){
+		int len = strlen(ent->d_name);
+		if (len > 7 && !strcmp(ent->d_name + len - 7, ".syntax")) names = syntaxListAdd(names, &n, ent->d_name);
+	}
+	closedir(d);
+	if (n) qsort(names, n, sizeof(char*), syntaxNameCmp);
+	syntaxFiles = xmalloc(sizeof(struct editorSyntax*) * (n + 1));
+	char file[PATH_MAX];
+	for (int i = 0; i < n; i++){
+		struct editorSyntax* s = NULL;
+		if (snprintf(file, sizeof(file), "%s/%s", dir, names[i]) < (int)sizeof(file)) s = syntaxReadFile(file);
+		if (s) syntaxFiles[nsyntaxFiles++] = s;
+		free(names[i]);
+	}
+	free(names);
+}
+
+/** row operations **/
+
+// Column index of a long row. Finds out once whether the row has tabs at all, and if
+// it does, extends the checkpoints until checkpoint k is known or one lies past column
+// rx, so converting a column only walks from the checkpoint before it.
+void editorRowColumns(erow* row, int k, int rx){
+	if (row->flags & ROW_NOTABS) return;
+	if (row->cols == NULL && memchr(row->chars, '\t', row->size) == NULL){
+		row->flags |= ROW_NOTABS;
+		return;
+	}
+
+	int need = row->size / WYNAUT_COL_STRIDE + 1;
+	struct rowCols* c = row->cols;
+	if (c == NULL || c->cap < need){
+		int cap = need + need / 4;
+		c = xrealloc(c, sizeof(struct rowCols) + sizeof(int) * cap);
+		if (row->cols == NULL) c->n = 0;
+		c->cap = cap;
+		row->cols = c;
+	}
+	if (c->n == 0) c->rx[c->n++] = 0;
+
+	while (c->n < need && (c->n <= k || c->rx[c->n - 1] <= rx)){
+		int j = (c->n - 1) * WYNAUT_COL_STRIDE;
+		int end = j + WYNAUT_COL_STRIDE;
+		int cur = c->rx[c->n - 1];
+		for (; j < end; j++){
+			if (row->chars[j] == '\t')
+				cur += (WYNAUT_TAB_STOP-1) - (cur % WYNAUT_TAB_STOP);
+			cur++;
+		}
+		c->rx[c->n++] = cur;
+	}
+}
+
+// Keeps the column index right across an edit at `at`: the checkpoints up to the edit
+// still hold, and inserted text s may bring the first tab.
+void editorRowColumnsEdit(erow* row, int at, const char* s, int len){
+	if (s && memchr(s, '\t', len)) row->flags &= ~ROW_NOTABS;
+	if (row->cols && row->cols->n > at / WYNAUT_COL_STRIDE + 1) row->cols->n = at / WYNAUT_COL_STRIDE + 1;
+}
+
+int editorRowCxToRx(erow* row, int cx){
+	if (row->size >= WYNAUT_COL_STRIDE) editorRowColumns(row, cx / WYNAUT_COL_STRIDE, -1);
+	// without tabs a char takes one column
+	if (row->flags & ROW_NOTABS) return cx;
+	int rx = 0;
+	int j = 0;
+	if (row->cols){
+		j = cx / WYNAUT_COL_STRIDE * WYNAUT_COL_STRIDE;
+		rx = row->cols->rx[cx / WYNAUT_COL_STRIDE];
+	}
+	for (; j<cx;j++){
+		if (row->chars[j] == '\t')
+			rx += (WYNAUT_TAB_STOP-1) - (rx % WYNAUT_TAB_STOP);
+		rx++;
+	}
+	return rx;
+}
+
+int editorRowRxToCx(erow* row, int rx){
+	if (row->size >= WYNAUT_COL_STRIDE) editorRowColumns(row, 0, rx);
+	if (row->flags & ROW_NOTABS) return rx < row->size ? rx : row->size;
+	int cur_rx = 0;
+	int cx = 0;
+	if (row->cols){
+		// last checkpoint at or before rx
+		int lo = 0, hi = row->cols->n - 1;
+		while (lo < hi){
+			int mid = (lo + hi + 1) / 2;
+			if (row->cols->rx[mid] <= rx) lo = mid;
+			else hi = mid - 1;
+		}
+		cx = lo * WYNAUT_COL_STRIDE;
+		cur_rx = row->cols->rx[lo];
+	}
+	for (; cx < row->size; cx++){
+		if (row->chars[cx] == '\t'){
+			cur_rx += (WYNAUT_TAB_STOP - 1) - (cur_rx % WYNAUT_TAB_STOP);
+		}
+		cur_rx++;
+
+		if (cur_rx > rx) return cx;
+	}
+	return cx;
+}
+
+// frees render and hl, they are rebuilt by editorRowPrepare when needed
+void editorRowDropCache(erow* row){
+	if (row->render == NULL) return;
+	E.cache_bytes -= row->rcap + row->hlcap;
+	if (!(row->flags & ROW_RENDER_SHARED)) rowmemFree(row->render, row->rcap);
+	rowmemFree((char*)row->hl, row->hlcap);
+	row->render = NULL;
+	row->hl = NULL;
+	row->rsize = 0;
+	row->rcap = 0;
+	row->hlcap = 0;
+	row->flags &= ~ROW_RENDER_SHARED;
+}
+
+// Builds render from chars and highlights it, at is the row's position.
+// Rows longer than WYNAUT_LONG_LINE only get the chars around the visible columns,
+// their highlighting starts fresh at the window, WYNAUT_LONG_MARGIN before the screen.
+void editorRowRender(erow* row, int at, int plain){
+	long long probe = editorNanos();
+	int cx0 = 0;
+	int cx1 = row->size;
+	if (row->size > WYNAUT_LONG_LINE){
+		cx0 = editorRowRxToCx(row, E.coloff > WYNAUT_LONG_MARGIN ? E.coloff - WYNAUT_LONG_MARGIN : 0);
+		cx1 = editorRowRxToCx(row, E.coloff + E.screencols + WYNAUT_LONG_MARGIN);
+	}
+	int rx0 = cx0 ? editorRowCxToRx(row, cx0) : 0;
+
+	int tabs = 0;
+	for (int i =cx0; i<cx1;i++){
+		if (row->chars[i] == '\t') tabs++;
+	}
+
+	// the old buffers are kept when they are big enough, typing doesn't allocate
+	int need = cx1 - cx0 + tabs*(WYNAUT_TAB_STOP-1) + 1;
+	if (need > row->hlcap || (tabs && need > row->rcap)) editorRowDropCache(row);
+	if (row->hl == NULL){
+		row->hl = (unsigned char*)rowmemAlloc(need, &row->hlcap);
+		E.cache_bytes += row->hlcap;
+	}
+
+	if (tabs == 0){
+		// nothing to expand, render is chars itself
+		if (row->rcap){
+			rowmemFree(row->render, row->rcap);
+			E.cache_bytes -= row->rcap;
+			row->rcap = 0;
+		}
+		row->render = row->chars + cx0;
+		row->rsize = cx1 - cx0;
+		row->flags |= ROW_RENDER_SHARED;
+		if (cx0 == 0 && cx1 == row->size) row->flags |= ROW_NOTABS;
+	}
+	else{
+		if (row->rcap == 0){
+			row->render = rowmemAlloc(need, &row->rcap);
+			E.cache_bytes += row->rcap;
+		}
+		row->flags &= ~ROW_RENDER_SHARED;
+		int idx = 0;
+		for (int j =cx0; j<cx1;j++){
+			if(row->chars[j] == '\t'){
+				row->render[idx++] = ' ';
+				while ((rx0 + idx) % WYNAUT_TAB_STOP != 0) row->render[idx++] = ' ';
+			}
+			else{
+				row->render[idx++] = row->chars[j];
+			}
+		}
+		row->render[idx] = '\0';
+		row->rsize = idx;
+	}
+	row->rx0 = rx0;
+	row->cx1 = cx1;
+
+	// the clock read after the syntax pass ends both probes, it is the last real work
+	long long done;
+	if (plain){
+		memset(row->hl, HL_NORMAL, row->rsize);
+		row->flags |= ROW_PLAIN;
+		done = editorNanos();
+	}
+	else{
+		int in = cx0 ? 0 : editorRowInState(at);
+		long long syntax = editorNanos();
+		editorUpdateSyntax(row, in);
+		done = editorNanos();
+		statAdd(STAT_SYNTAX, done - syntax);
+		row->flags &= ~ROW_PLAIN;
+	}
+	row->flags &= ~ROW_STALE;
+	row->hlgen = E.hlgen;
+	statAdd(STAT_RENDER, done - probe);
+}
+
+// Frees render and hl of the rows away from the screen once the caches outgrow
+// their budget, so scrolling or searching through a big file doesn't keep
+// every row's render around. keep is the row being prepared right now.
+void editorEvictCaches(erow* keep){
+	int lo = E.rowoff - E.screenrows;
+	int hi = E.rowoff + 2 * E.screenrows;
+	int at = 0;
+	// chunks that are paged out have nothing cached
+	for (int k = 0; k < E.rows->chunks; k++){
+		rowchunk* c = rowChunkNth(k);
+		for (int i = 0; c->rows && i < c->n; i++){
+			erow* row = &c->rows[i];
+			if (row->render && row != keep && (at + i < lo || at + i >= hi)) editorRowDropCache(row);
+		}
+		at += c->n;
+	}
+}
+
+// frees render and hl of every row, for files that aren't on screen
+void editorDropCaches(){
+	for (int k = 0; E.rows && k < E.rows->chunks; k++){
+		rowchunk* c = rowChunkNth(k);
+		for (int i = 0; c->rows && i < c->n; i++){
+			if (c->rows[i].render) editorRowDropCache(&c->rows[i]);
+		}
+	}
+}
+
+// Keeps render and hl of all open files within WYNAUT_RENDER_BUDGET. The files in the
+// background lose all of theirs first, they are rebuilt once those files are shown again.
+// Files are only swapped while fuzzy find's workers aren't reading E.
+void editorCacheTrim(erow* keep){
+	size_t total = E.cache_bytes;
+	for (int k = 0; k < buffers.n; k++){
+		if (k != buffers.cur) total += buffers.list[k].cache_bytes;
+	}
+	if (total <= WYNAUT_RENDER_BUDGET) return;
+	int cur = buffers.cur;
+	for (int k = 0; k < buffers.n && !E.fuzzy; k++){
+		if (k == cur || buffers.list[k].cache_bytes == 0) continue;
+		editorBufferUse(k);
+		editorDropCaches();
+		editorBufferUse(cur);
+	}
+	if (E.cache_bytes > WYNAUT_RENDER_BUDGET) editorEvictCaches(keep);
+}
+
+// Makes sure render and hl of the row at `at` are up to date, only rows that are
+// shown or searched need them. Comment state is brought up to date through this row first,
+// unless that is far off, then the row is left plain until the syntax worker gets there.
+void editorRowPrepare(erow* row, int at){
+	int plain = editorSyntaxBehind(at);
+	if (!plain) editorSyntaxCatchUp(at + 1);
+	// a long row's window has to cover the screen too
+	int covered = E.coloff >= row->rx0 &&
+		(row->cx1 == row->size || E.coloff + E.screencols <= row->rx0 + row->rsize);
+	if (row->render && !(row->flags & ROW_STALE) && row->hlgen == E.hlgen && covered &&
+			(plain || !(row->flags & ROW_PLAIN))) return;
+	editorRowRender(row, at, plain);
+	editorCacheTrim(row);
+}
+
+// chars of the row at `at` changed, render and hl get rebuilt the next time it is shown
+void editorUpdateRow(int at){
+	editorRowAt(at)->flags |= ROW_STALE;
+	editorSyntaxInvalidate(at, at + 1);
+}
+
+void editorInsertRow(int at,char* s, size_t len){
+	if (at < 0 || at > E.numrows) return;
+
+	erow row;
+	row.size = len;
+	row.chars = rowmemAlloc(len+1, &row.cap);
+	memcpy(row.chars,s,len);
+	row.chars[len] = '\0';
+
+	row.rsize = 0;
+	row.rcap = 0;
+	row.hlcap = 0;
+	row.render = NULL;
+	row.hl = NULL;
+	row.flags = 0;
+	row.hlgen = E.hlgen;
+	// the row after this one was highlighted starting from the previous row's state
+	row.hl_open_comment = at > 0 ? editorRowAt(at - 1)->hl_open_comment : 0;
+	row.cols = NULL;
+	row.rx0 = 0;
+	row.cx1 = 0;
+	editorUndoRecord(UNDO_INSERT_ROW, at, 0, s, len);
+	editorRowsInsert(at, &row);
+	editorSyntaxShift(at, 1);
+	editorSyntaxInvalidate(at, at + 1);
+
+	E.dirty++;
+	E.edits++;
+}
+
+// moves a row's chars off the file mapping, or out of a running save's snapshot,
+// so it can be edited
+void editorRowDetach(erow* row){
+	if (!(row->flags & (ROW_MAPPED | ROW_PINNED))) return;
+	char* old = row->chars;
+	int oldcap = row->cap;
+	char* chars = rowmemAlloc(row->size + 1, &row->cap);
+	memcpy(chars, row->chars, row->size);
+	chars[row->size] = '\0';
+	row->chars = chars;
+	if (row->flags & ROW_PINNED) editorSaveDefer(old, oldcap);
+	row->flags &= ~(ROW_MAPPED | ROW_PINNED);
+	// a shared render still points at the old chars
+	row->flags |= ROW_STALE;
+}
+
+// frees from memory a given row and the chars in it
+void editorFreeRow(erow* row){
+	editorRowDropCache(row);
+	free(row->cols);
+	if (row->flags & ROW_PINNED) editorSaveDefer(row->chars, row->cap);
+	else if (!(row->flags & ROW_MAPPED)) rowmemFree(row->chars, row->cap);
+}
+
+// handles deleting a char if it happens to be the start of the row
+void editorDelRow(int at){
+	if (at < 0 || at >= E.numrows) return;
+	erow* row = editorRowAt(at);
+	editorUndoRecord(UNDO_DELETE_ROW, at, 0, row->chars, row->size);
+	editorFreeRow(row);
+	editorRowsRemove(at);
+	// the row that moved up follows a different row now
+	editorSyntaxShift(at, -1);
+	if (at < E.numrows) editorUpdateRow(at);
+	E.dirty++;
+	E.edits++;
+}
+
+// deletes len characters starting at a given position in row r
+void editorRowDelete(int r, int at, int len){
+	erow* row = editorRowAt(r);
+	if (at < 0 || len <= 0 || at + len > row->size) return;
+	editorUndoRecord(UNDO_DELETE, r, at, &row->chars[at], len);
+	editorRowColumnsEdit(row, at, NULL, 0);
+	editorRowDetach(row);
+	// move all characters that come after the deleted ones back, with the null char
+	memmove(&row->chars[at],&row->chars[at+len],row->size - at - len + 1);
+	row->size -= len;
+	editorUpdateRow(r);
+	E.dirty++;
+	E.edits++;
+}
+
+// deletes characters given position in row r
+void editorRowDelChar(int r, int at){
+	editorRowDelete(r, at, 1);
+}
+
+// cuts row r short at a given position
+void editorRowTruncate(int r, int at){
+	editorRowDelete(r, at, editorRowAt(r)->size - at);
+}
+
+// Inserts len chars in a specific place of row r
+void editorRowInsertString(int r, int at, const char* s, size_t len){
+	erow* row = editorRowAt(r);
+	// checks if input point is in bounds
+	if (at < 0 || at > row->size) at = row->size;
+	editorUndoRecord(UNDO_INSERT, r, at, s, len);
+	editorRowColumnsEdit(row, at, s, len);
+	editorRowDetach(row);
+	// one more byte for the null char
+	row->chars = rowmemGrow(row->chars, row->size + 1, &row->cap, row->size + len + 1);
+	// All the characters from 'at' onwards are moved len steps ahead to
+	// make space for the inserted ones
+	memmove(&row->chars[at+len], &row->chars[at], row->size - at +1);
+	memcpy(&row->chars[at], s, len);
+	row->size += len;
+	editorUpdateRow(r);
+	E.dirty++;
+	E.edits++;
+}
+
+// Deals with how to modify a row and adds a char in a specific place of row r
+void editorRowInsertChar(int r, int at, int c){
+	char ch = c;
+	editorRowInsertString(r, at, &ch, 1);
+}
+
+void editorRowAppendString(int r, char* s, size_t len){
+	editorRowInsertString(r, editorRowAt(r)->size, s, len);
+}
+
+// Replaces len chars at `at` of row r with slen chars of s in one go. Undo sees it as a
+// deletion followed by an insertion.
+void editorRowReplace(int r, int at, int len, const char* s, int slen){
+	erow* row = editorRowAt(r);
+	if (at < 0 || len < 0 || at + len > row->size) return;
+	if (len) editorUndoRecord(UNDO_DELETE, r, at, &row->chars[at], len);
+	if (slen) editorUndoRecord(UNDO_INSERT, r, at, s, slen);
+	editorRowColumnsEdit(row, at, s, slen);
+	editorRowDetach(row);
+	row->chars = rowmemGrow(row->chars, row->size + 1, &row->cap, row->size - len + slen + 1);
+	memmove(&row->chars[at + slen], &row->chars[at + len], row->size - at - len + 1);
+	memcpy(&row->chars[at], s, slen);
+	row->size += slen - len;
+	editorUpdateRow(r);
+	E.dirty++;
+	E.edits++;
+}
+
+/** paging **/
+
+// Finds the end of the line starting at p, with the same trimming as the getline path.
+// Sets *len to the length of the line and returns where the next one starts.
+const char* editorNextLine(const char* p, const char* end, int* len){
+	const char* nl = memchr(p, '\n', end - p);
+	const char* next = nl ? nl + 1 : end;
+	size_t l = next - p;
+	while (l > 0 && (p[l-1] == '\n' || p[l-1] == '\r')) l--;
+	*len = l;
+	return next;
+}
+
+// fills in a row whose chars are borrowed, render and hl get built the first time it is shown
+void editorRowBorrow(erow* row, const char* s, int len){
+	row->size = len;
+	row->rsize = 0;
+	row->cap = 0;
+	row->rcap = 0;
+	row->hlcap = 0;
+	row->chars = (char*)s;
+	row->render = NULL;
+	row->hl = NULL;
+	row->flags = ROW_MAPPED;
+	row->hlgen = E.hlgen;
+	row->hl_open_comment = 0;
+	row->cols = NULL;
+	row->rx0 = 0;
+	row->cx1 = 0;
+}
+
+// pread and pwrite that don't stop short, return -1 on error
+int editorPread(int fd, char* buf, long long len, long long off){
+	while (len > 0){
+		ssize_t n = pread(fd, buf, len, off);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		buf += n;
+		off += n;
+		len -= n;
+	}
+	return 0;
+}
+int editorPwrite(int fd, const char* buf, long long len, long long off){
+	while (len > 0){
+		ssize_t n = pwrite(fd, buf, len, off);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		buf += n;
+		off += n;
+		len -= n;
+	}
+	return 0;
+}
+
+// Text of a paged out chunk. From the mapping it is there already, from the scratch file
+// it is read into *own, which the caller frees. NULL when that read failed.
+const char* rowChunkText(rowchunk* c, char** own){
+	*own = NULL;
+	if (!(c->flags & CHUNK_SPILLED)) return E.map + c->src;
+	*own = xmalloc(c->srclen ? c->srclen : 1);
+	if (editorPread(E.page.scratchfd, *own, c->srclen, c->src) == -1){
+		free(*own);
+		*own = NULL;
+	}
+	return *own;
+}
+
+// Walks the chars of rows in order without paging chunks in, for scans that only read
+// them. Nothing may be paged in or out while one is in use.
+struct lineiter {
+	rowchunk* c;
+	int ci;
+	int i; // next row in c
+	int line; // number of that row
+	const char* p; // where it starts in a paged out chunk's text
+	const char* end;
+	char* own;
+};
+
+void editorLineIterChunk(struct lineiter* it, rowchunk* c, int ci){
+	free(it->own);
+	it->own = NULL;
+	it->c = c;
+	it->ci = ci;
+	it->i = 0;
+	it->p = it->end = NULL;
+	if (c && c->rows == NULL){
+		it->p = rowChunkText(c, &it->own);
+		if (it->p) it->end = it->p + c->srclen;
+	}
+}
+
+// the next row's chars, returns 0 past the last row
+int editorLineIterNext(struct lineiter* it, const char** s, int* len){
+	while (it->c && it->i >= it->c->n){
+		editorLineIterChunk(it, rowChunkNth(it->ci + 1), it->ci + 1);
+	}
+	if (it->c == NULL) return 0;
+	if (it->c->rows){
+		*s = it->c->rows[it->i].chars;
+		*len = it->c->rows[it->i].size;
+	}
+	else if (it->p){
+		*s = it->p;
+		it->p = editorNextLine(it->p, it->end, len);
+	}
+	else{
+		// the scratch file couldn't be read
+		*s = "";
+		*len = 0;
+	}
+	it->i++;
+	it->line++;
+	return 1;
+}
+
+// moves on to row `at`, which can't be behind the iterator
+void editorLineIterSkip(struct lineiter* it, int at){
+	if (it->c == NULL || at - it->line >= it->c->n - it->i){
+		// chunks in between are stepped over without reading their text
+		int local = 0, ci = 0;
+		rowchunk* c = at < E.numrows ? rowChunkLocate(at, &local, &ci, NULL, NULL) : NULL;
+		editorLineIterChunk(it, c, ci);
+		it->line = at - local;
+	}
+	if (it->c && it->c->rows){
+		it->i += at - it->line;
+		it->line = at;
+	}
+	const char* s;
+	int len;
+	while (it->c && it->line < at) editorLineIterNext(it, &s, &len);
+}
+
+void editorLineIterInit(struct lineiter* it, int at){
+	it->c = NULL;
+	it->own = NULL;
+	editorLineIterSkip(it, at);
+}
+
+void editorLineIterFree(struct lineiter* it){
+	free(it->own);
+	it->own = NULL;
+}
+
+// Pages a chunk back in. Its rows borrow their chars from the file mapping, or from a
+// buffer read back from the scratch file, and their comment state is lexed on the way.
+// An index entry of more than WYNAUT_ROW_CHUNK rows comes back as several chunks.
+// Returns the first of them, it takes t's place at position ci.
+rowchunk* rowChunkLoad(rowchunk* t, int ci){
+	char* buf;
+	const char* p = rowChunkText(t, &buf);
+	if (p == NULL) die("pread");
+	const char* end = p + t->srclen;
+	long long pos = t->src;
+
+	int in = 0;
+	if (ci > 0 && editorSyntaxHasState()){
+		rowchunk* prev = rowChunkNth(ci - 1);
+		in = prev->rows ? prev->rows[prev->n - 1].hl_open_comment : prev->hl_end;
+	}
+
+	rowchunk *a, *b, *mid;
+	rowChunkSplit(E.rows, ci, &a, &b);
+	rowChunkSplit(b, 1, &mid, &b);
+	rowchunk* first = NULL;
+	int left = t->n;
+	while (left > 0){
+		rowchunk* c = rowChunkNew();
+		c->src = pos;
+		c->flags = t->flags & CHUNK_SPILLED;
+		while (c->n < WYNAUT_ROW_CHUNK && left > 0){
+			int len;
+			const char* next = editorNextLine(p, end, &len);
+			if (next - p != len + 1) c->flags |= CHUNK_CR;
+			erow* row = &c->rows[c->n++];
+			editorRowBorrow(row, p, len);
+			if (editorSyntaxHasState()) in = editorSyntaxLex(p, len, in);
+			row->hl_open_comment = in;
+			pos += next - p;
+			p = next;
+			left--;
+		}
+		c->srclen = pos - c->src;
+		c->used = ++E.page.clock;
+		rowChunkPull(c);
+		a = rowChunkMerge(a, c);
+		if (first == NULL) first = c;
+	}
+	E.rows = rowChunkMerge(a, b);
+	// spilled chunks are never bigger than WYNAUT_ROW_CHUNK, the buffer is first's alone
+	if (buf){
+		first->buf = buf;
+		E.page.bytes += first->srclen;
+	}
+	E.page.loads++;
+	free(t);
+	return first;
+}
+
+// the scratch file is unlinked right away, it goes with the editor
+int editorScratchOpen(){
+	char path[PATH_MAX];
+	char* dir = getenv("TMPDIR");
+	snprintf(path, sizeof(path), "%s/wynaut-XXXXXX", dir && *dir ? dir : "/tmp");
+	int fd = mkstemp(path);
+	if (fd != -1) unlink(path);
+	return fd;
+}
+
+// Pages a chunk out. One whose rows still match its text in the file or the scratch
+// file is just dropped, others are appended to the scratch file first.
+// Returns -1 when that write failed, the chunk stays in then.
+int rowChunkPageOut(rowchunk* c){
+	int clean = !(c->flags & CHUNK_MODIFIED);
+	for (int i = 0; clean && i < c->n; i++){
+		if (!(c->rows[i].flags & ROW_MAPPED)) clean = 0;
+	}
+	long long off = E.page.scratchlen;
+	long long len = 0;
+	if (!clean){
+		for (int i = 0; i < c->n; i++) len += c->rows[i].size + 1;
+		char* text = xmalloc(len ? len : 1);
+		char* p = text;
+		for (int i = 0; i < c->n; i++){
+			memcpy(p, c->rows[i].chars, c->rows[i].size);
+			p += c->rows[i].size;
+			*p++ = '\n';
+		}
+		if (E.page.scratchfd == -1) E.page.scratchfd = editorScratchOpen();
+		int ok = E.page.scratchfd != -1 && editorPwrite(E.page.scratchfd, text, len, off) == 0;
+		free(text);
+		if (!ok) return -1;
+		E.page.scratchlen += len;
+		E.page.spills++;
+	}
+
+	c->hl_end = c->n ? c->rows[c->n - 1].hl_open_comment : 0;
+	for (int i = 0; i < c->n; i++) editorFreeRow(&c->rows[i]);
+	free(c->rows);
+	c->rows = NULL;
+	E.page.bytes -= sizeof(erow) * WYNAUT_ROW_CHUNK;
+	rowChunkDropBuf(c);
+	if (!clean){
+		c->src = off;
+		c->srclen = len;
+		c->flags = CHUNK_SPILLED;
+	}
+	return 0;
+}
+
+int pageCompare(const void* a, const void* b){
+	long long x = (*(rowchunk**)a)->used;
+	long long y = (*(rowchunk**)b)->used;
+	return x < y ? -1 : x > y;
+}
+
+// bytes the rows of all open files take, what E.page.budget is held against
+size_t editorMemoryUsed(){
+	size_t used = rowmem.bytes + E.page.bytes;
+	for (int k = 0; k < buffers.n; k++){
+		if (k != buffers.cur) used += buffers.list[k].page.bytes;
+	}
+	return used;
+}
+
+// Pages out the chunks of the file in E used least recently until all files together
+// are down to goal. Chunks around its screen and its cursor stay.
+void editorPageTrimTo(size_t goal){
+	if (editorMemoryUsed() <= goal || E.rows == NULL) return;
+	int lo = E.rowoff - E.screenrows;
+	int hi = E.rowoff + 2 * E.screenrows;
+	int nchunks = E.rows->chunks;
+	rowchunk** cand = xmalloc(sizeof(rowchunk*) * nchunks);
+	int n = 0;
+	int line = 0;
+	for (int k = 0; k < nchunks; k++){
+		rowchunk* c = rowChunkNth(k);
+		int keep = (line < hi && line + c->n > lo) || (E.cy >= line && E.cy < line + c->n);
+		if (c->rows && !keep) cand[n++] = c;
+		line += c->n;
+	}
+	qsort(cand, n, sizeof(rowchunk*), pageCompare);
+	for (int i = 0; i < n && editorMemoryUsed() > goal; i++) rowChunkPageOut(cand[i]);
+	free(cand);
+}
+
+// Brings the rows of all open files back within their budget once they outgrow it. The
+// files in the background give up their render and hl first, then their chunks, the file
+// being edited comes last. Nothing moves while fuzzy find's workers read the chunks.
+// Only called where no row pointers are held.
+void editorPageTrim(){
+	if (editorMemoryUsed() <= E.page.budget || E.fuzzy) return;
+	size_t goal = E.page.budget / 4 * 3;
+	int cur = buffers.cur;
+	for (int k = 0; k < buffers.n && editorMemoryUsed() > goal; k++){
+		if (k == cur) continue;
+		editorBufferUse(k);
+		editorDropCaches();
+		editorBufferUse(cur);
+	}
+	for (int k = 0; k < buffers.n && editorMemoryUsed() > goal; k++){
+		if (k == cur) continue;
+		editorBufferUse(k);
+		editorPageTrimTo(goal);
+		editorBufferUse(cur);
+	}
+	editorPageTrimTo(goal);
+}
+
+/** syntax worker **/
+
+// The worker only touches rows while holding worker.lock, which the main thread gives up
+// just for the time it sits waiting on a key. Rows are never edited under the worker then,
+// and it can't keep a key waiting for more than a slice.
+
+// takes the rows back from the worker
+void editorLock(){
+	__atomic_store_n(&worker.hold, 1, __ATOMIC_RELEASE);
+	pthread_mutex_lock(&worker.lock);
+}
+
+// hands the rows to the worker
+void editorUnlock(){
+	__atomic_store_n(&worker.hold, 0, __ATOMIC_RELEASE);
+	pthread_cond_signal(&worker.wake);
+	pthread_mutex_unlock(&worker.lock);
+}
+
+// One slice of background highlighting, returns 0 when there is nothing left to do.
+// The comment state is brought up to date through the bottom of the screen first, then
+// the rows on screen that were drawn plain are highlighted, then the rest of the file
+// catches up so that jumping there later doesn't have to wait.
+int editorSyntaxWork(){
+	editorPageTrim();
+	if (!editorSyntaxHasState() || E.syn_lo >= E.syn_hi) return 0;
+	long long deadline = editorMicros() + WYNAUT_SLICE_US;
+	int bottom = E.rowoff + E.screenrows;
+	if (bottom > E.numrows) bottom = E.numrows;
+	if (E.syn_lo < bottom){
+		while (E.syn_lo < E.syn_hi && E.syn_lo < bottom && editorMicros() < deadline)
+			editorSyntaxCatchUp(E.syn_lo + WYNAUT_HL_BATCH < bottom ? E.syn_lo + WYNAUT_HL_BATCH : bottom);
+		if (E.syn_lo < E.syn_hi && E.syn_lo < bottom) return 1;
+	}
+
+	int shown = 0;
+	for (int at = E.rowoff; at < bottom; at++){
+		erow* row = editorRowAt(at);
+		if (row->render && (row->flags & ROW_PLAIN)){
+			editorRowPrepare(row, at);
+			shown = 1;
+		}
+	}
+	if (shown){
+		// wakes the main thread up to redraw
+		if (write(worker.pipe[1], "", 1) == -1){}
+		return 1;
+	}
+
+	while (E.syn_lo < E.syn_hi && editorMicros() < deadline)
+		editorSyntaxCatchUp(E.syn_lo + WYNAUT_HL_BATCH);
+	return 1;
+}
+
+void* editorSyntaxWorker(void* arg){
+	(void)arg;
+	pthread_mutex_lock(&worker.lock);
+	while (1){
+		if (__atomic_load_n(&worker.hold, __ATOMIC_ACQUIRE) || !editorSyntaxWork()){
+			pthread_cond_wait(&worker.wake, &worker.lock);
+			continue;
+		}
+		// gives the main thread a chance at the lock between slices
+		pthread_mutex_unlock(&worker.lock);
+		pthread_mutex_lock(&worker.lock);
+	}
+	return NULL;
+}
+
+// Waits for input with the rows handed to the worker. Returns 1 once input arrived
+// and 0 when the worker finished highlighting rows that are on screen.
+int editorWaitInput(){
+	struct pollfd pfd[2] = {{E.infd, POLLIN, 0}, {worker.pipe[0], POLLIN, 0}};
+	editorUnlock();
+	while (poll(pfd, 2, -1) == -1 && errno == EINTR);
+	editorLock();
+	if (pfd[1].revents & POLLIN){
+		char drain[64];
+		while (read(worker.pipe[0], drain, sizeof(drain)) > 0);
+	}
+	return (pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) != 0;
+}
+
+void editorStartWorker(){
+	pthread_mutex_init(&worker.lock, NULL);
+	pthread_cond_init(&worker.wake, NULL);
+	editorLock();
+	if (pipe(worker.pipe) == -1) die("pipe");
+	fcntl(worker.pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(worker.pipe[1], F_SETFL, O_NONBLOCK);
+	// a replay does the work itself between keys, timings stay repeatable that way
+	if (E.replay) return;
+	pthread_t t;
+	if (pthread_create(&t, NULL, editorSyntaxWorker, NULL) != 0) die("pthread_create");
+	pthread_detach(t);
+}
+
+/** editor operations **/
+
+// Deals with where the cursor is and adds a char
+void editorInsertChar(int c){
+	// checks if cursor is at end of line,and then adds a new row
+	if(E.cy == E.numrows) {
+		editorInsertRow(E.numrows, "",0);
+	}
+	editorRowInsertChar(E.cy,E.cx,c);
+	E.cx++; // move cursor forward
+}
+
+// mapped to return key
+void editorInsertNewline() {
+	if (E.cx == 0){
+		editorInsertRow(E.cy, "", 0);
+	}
+	else{
+		erow* row = editorRowAt(E.cy);
+		editorInsertRow(E.cy +1, &row->chars[E.cx],row->size - E.cx);
+		editorRowTruncate(E.cy, E.cx);
+	}
+	E.cy++;
+	E.cx = 0;
+}
+// Inserts text at the cursor, line breaks in it start new rows. Each line goes in
+// with one row operation, which is what makes pasting big chunks fast.
+void editorInsertText(const char* s, size_t len){
+	if (E.cy == E.numrows) editorInsertRow(E.numrows, "", 0);
+	const char* end = s + len;
+	const char* nl = s;
+	while (nl < end && *nl != '\r' && *nl != '\n') nl++;
+	if (nl == end){
+		editorRowInsertString(E.cy, E.cx, s, len);
+		E.cx += len;
+		return;
+	}
+
+	// what follows the cursor moves to the end of the last line
+	erow* row = editorRowAt(E.cy);
+	int taillen = row->size - E.cx;
+	char* tail = xmalloc(taillen + 1);
+	memcpy(tail, &row->chars[E.cx], taillen);
+	editorRowTruncate(E.cy, E.cx);
+	editorRowAppendString(E.cy, (char*)s, nl - s);
+
+	while (nl < end){
+		// \r\n, \r and \n all end a line
+		s = nl + 1;
+		if (*nl == '\r' && s < end && *s == '\n') s++;
+		nl = s;
+		while (nl < end && *nl != '\r' && *nl != '\n') nl++;
+		editorInsertRow(++E.cy, (char*)s, nl - s);
+	}
+	E.cx = nl - s;
+	editorRowAppendString(E.cy, tail, taillen);
+	free(tail);
+}
+
+// Mapped to Backspace character
+void editorDelChar(){
+	if(E.cy == E.numrows) return;
+	if(E.cx==0 && E.cy == 0)return;
+	if (E.cx >0){
+		editorRowDelChar(E.cy,E.cx-1);
+		E.cx--;
+	}
+	else{ // moves everything to the end of the last line and deletes current row
+		erow* row = editorRowAt(E.cy);
+		// the cursor only moves once the edit is recorded, undo puts it back where it was
+		int cx = editorRowAt(E.cy-1)->size;
+		editorRowAppendString(E.cy-1,row->chars,row->size);
+		editorDelRow(E.cy);
+		E.cy--;
+		E.cx = cx;
+	}
+}
+
+/** undo **/
+
+// Each op is a header followed by its text, ops are packed one after the other in
+// E.undo.log. Ops of one undo step are applied together, the first one carries UNDO_START.
+struct undoOp {
+	int kind; // one of undoKind
+	int start; // first op of an undo step
+	int row;
+	int at; // byte offset in the row, unused for whole rows
+	int len; // bytes of text after the header
+	int prev; // offset of the op before this one, -1 for the first
+	int cx, cy; // cursor before the op
+};
+
+#define UNDO_ALIGN 8
+
+struct undoOp* undoOpAt(int off){
+	return (struct undoOp*)(E.undo.log + off);
+}
+
+char* undoOpText(struct undoOp* op){
+	return (char*)(op + 1);
+}
+
+int undoOpSize(int len){
+	int size = sizeof(struct undoOp) + len;
+	return (size + UNDO_ALIGN - 1) & ~(UNDO_ALIGN - 1);
+}
+
+// offset of the op after the one at off, or of the first op when off is -1
+int undoNext(int off){
+	return off == -1 ? 0 : off + undoOpSize(undoOpAt(off)->len);
+}
+
+// forgets the whole history, used when a file is opened
+void editorUndoReset(){
+	free(E.undo.log);
+	E.undo.log = NULL;
+	E.undo.used = E.undo.cap = 0;
+	E.undo.top = -1;
+	E.undo.open = 0;
+	E.undo.dropped = 0;
+	E.undo.clean = -1;
+}
+
+// The ops from offset cut on are gone, so is the saved state if it was one of them, both
+// the one on disk and the one a save in progress is writing. -1 forgets it either way.
+void editorUndoForget(int cut){
+	if (E.undo.clean >= cut) E.undo.clean = -2;
+	if (E.saving && E.saving->undo_top >= cut) E.saving->undo_top = -2;
+}
+
+// ends the current undo step, the next edit starts a new one
+void editorUndoBreak(){
+	E.undo.open = 0;
+	E.undo.dropped = 0;
+}
+
+// Drops the oldest steps until the log is down to half its budget, but never the
+// step still being recorded. Offsets move, so every op's prev is rewritten, which
+// is fine as this only happens once per half a budget worth of edits.
+void editorUndoTrim(){
+	int keep = E.undo.used;
+	if (E.undo.open && E.undo.top != -1){
+		keep = E.undo.top;
+		while (!undoOpAt(keep)->start) keep = undoOpAt(keep)->prev;
+	}
+	int cut = 0;
+	while (cut < keep && (E.undo.used - cut > E.undo.budget / 2 || !undoOpAt(cut)->start)){
+		cut = undoNext(cut);
+	}
+	memmove(E.undo.log, E.undo.log + cut, E.undo.used - cut);
+	E.undo.used -= cut;
+	for (int off = 0; off < E.undo.used; off = undoNext(off)){
+		struct undoOp* op = undoOpAt(off);
+		op->prev = op->prev < cut ? -1 : op->prev - cut;
+	}
+	E.undo.top = E.undo.top < cut ? -1 : E.undo.top - cut;
+	if (E.undo.clean != -2) E.undo.clean = E.undo.clean < cut ? -2 : E.undo.clean - cut;
+	if (E.saving && E.saving->undo_top != -2)
+		E.saving->undo_top = E.saving->undo_top < cut ? -2 : E.saving->undo_top - cut;
+}
+
+// Whether an op can be folded into the last one: typing extends an insert at its end,
+// backspace and delete grow a deletion from either side.
+int editorUndoCoalesce(struct undoOp* last, int kind, int row, int at){
+	if (!E.undo.open || last->kind != kind || last->row != row) return 0;
+	if (kind == UNDO_INSERT) return at == last->at + last->len;
+	if (kind == UNDO_DELETE) return at == last->at || at + 1 == last->at;
+	return 0;
+}
+
+// Called by the row primitives for every change. s is the text that was inserted,
+// or the text that is about to be deleted.
+void editorUndoRecord(int kind, int row, int at, const char* s, int len){
+	if (E.undo.paused || E.undo.dropped) return;
+
+	// a new edit makes whatever was undone unreachable
+	int end = undoNext(E.undo.top);
+	if (end < E.undo.used){
+		E.undo.used = end;
+		editorUndoForget(end);
+	}
+
+	int size = undoOpSize(len);
+	if (size > E.undo.budget){
+		// a single change bigger than the whole budget, history can't go past it
+		editorUndoReset();
+		editorUndoForget(-1);
+		E.undo.dropped = 1;
+		return;
+	}
+
+	struct undoOp* last = E.undo.top == -1 ? NULL : undoOpAt(E.undo.top);
+	if (last && E.undo.clean != E.undo.top && len == 1 && editorUndoCoalesce(last, kind, row, at) &&
+			E.undo.top + undoOpSize(last->len + 1) <= E.undo.budget){
+		int grown = undoOpSize(last->len + 1);
+		if (E.undo.top + grown > E.undo.cap){
+			E.undo.cap = (E.undo.top + grown) * 2;
+			E.undo.log = xrealloc(E.undo.log, E.undo.cap);
+			last = undoOpAt(E.undo.top);
+		}
+		char* text = undoOpText(last);
+		if (kind == UNDO_DELETE && at + 1 == last->at){
+			// backspace, the new char goes in front
+			memmove(text + 1, text, last->len);
+			text[0] = s[0];
+			last->at = at;
+		}
+		else{
+			text[last->len] = s[0];
+		}
+		last->len++;
+		E.undo.used = E.undo.top + grown;
+		return;
+	}
+
+	if (E.undo.used + size > E.undo.budget) editorUndoTrim();
+	if (E.undo.used + size > E.undo.budget){
+		// the open step alone takes the whole budget, it can't be undone so the
+		// history before it goes too
+		editorUndoReset();
+		editorUndoForget(-1);
+		E.undo.dropped = 1;
+		return;
+	}
+	if (E.undo.used + size > E.undo.cap){
+		E.undo.cap = (E.undo.used + size) * 2;
+		E.undo.log = xrealloc(E.undo.log, E.undo.cap);
+	}
+	struct undoOp* op = undoOpAt(E.undo.used);
+	op->kind = kind;
+	op->start = !E.undo.open || E.undo.top == -1;
+	op->row = row;
+	op->at = at;
+	op->len = len;
+	op->prev = E.undo.top;
+	op->cx = E.cx;
+	op->cy = E.cy;
+	memcpy(undoOpText(op), s, len);
+	E.undo.top = E.undo.used;
+	E.undo.used += size;
+	E.undo.open = 1;
+}
+
+// applies an op, or its inverse, through the row primitives
+void editorUndoApply(struct undoOp* op, int inverse){
+	int kind = op->kind;
+	if (inverse){
+		if (kind == UNDO_INSERT) kind = UNDO_DELETE;
+		else if (kind == UNDO_DELETE) kind = UNDO_INSERT;
+		else if (kind == UNDO_INSERT_ROW) kind = UNDO_DELETE_ROW;
+		else kind = UNDO_INSERT_ROW;
+	}
+	switch (kind){
+		case UNDO_INSERT:
+			editorRowInsertString(op->row, op->at, undoOpText(op), op->len);
+			E.cy = op->row;
+			E.cx = op->at + op->len;
+			break;
+		case UNDO_DELETE:
+			editorRowDelete(op->row, op->at, op->len);
+			E.cy = op->row;
+			E.cx = op->at;
+			break;
+		case UNDO_INSERT_ROW:
+			editorInsertRow(op->row, undoOpText(op), op->len);
+			E.cy = op->row;
+			E.cx = 0;
+			break;
+		case UNDO_DELETE_ROW:
+			editorDelRow(op->row);
+			E.cy = op->row;
+			E.cx = 0;
+			break;
+	}
+}
+
+// the buffer is back where it was saved, or isn't anymore
+void editorUndoSyncDirty(){
+	if (E.undo.top == E.undo.clean) E.dirty = 0;
+	else if (E.dirty == 0) E.dirty = 1;
+}
+
+// Reverts the last step, ops are undone newest first
+void editorUndo(){
+	editorUndoBreak();
+	if (E.undo.top == -1){
+		editorSetStatusMessage("Nothing to undo");
+		return;
+	}
+	E.undo.paused = 1;
+	struct undoOp* op;
+	do{
+		op = undoOpAt(E.undo.top);
+		editorUndoApply(op, 1);
+		E.undo.top = op->prev;
+	} while (!op->start);
+	E.undo.paused = 0;
+	E.cx = op->cx;
+	E.cy = op->cy;
+	editorUndoSyncDirty();
+}
+
+// Reapplies the step undone last
+void editorRedo(){
+	editorUndoBreak();
+	int off = undoNext(E.undo.top);
+	if (off >= E.undo.used){
+		editorSetStatusMessage("Nothing to redo");
+		return;
+	}
+	E.undo.paused = 1;
+	do{
+		editorUndoApply(undoOpAt(off), 0);
+		E.undo.top = off;
+		off = undoNext(off);
+	} while (off < E.undo.used && !undoOpAt(off)->start);
+	E.undo.paused = 0;
+	editorUndoSyncDirty();
+}
+
+/** line index **/
+
+// Counts the newlines in p[0..n), setting *cr when a \r turns up as well
+long long editorCountNewlines(const char* p, long long n, int* cr){
+	long long count = 0;
+	long long i = 0;
+#ifdef __SSE2__
+	__m128i nl = _mm_set1_epi8('\n');
+	__m128i ret = _mm_set1_epi8('\r');
+	__m128i seen = _mm_setzero_si128();
+	while (i + 16 <= n){
+		// per byte counters, summed up before any of them can wrap
+		__m128i acc = _mm_setzero_si128();
+		for (int k = 0; k < 255 && i + 16 <= n; k++, i += 16){
+			__m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+			acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, nl));
+			seen = _mm_or_si128(seen, _mm_cmpeq_epi8(v, ret));
+		}
+		__m128i sum = _mm_sad_epu8(acc, _mm_setzero_si128());
+		count += _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+	}
+	if (_mm_movemask_epi8(seen)) *cr = 1;
+#endif
+	for (; i < n; i++){
+		if (p[i] == '\n') count++;
+		else if (p[i] == '\r') *cr = 1;
+	}
+	return count;
+}
+
+// returns where the line after the k-th newline from p starts, NULL if end comes first
+const char* editorSkipLines(const char* p, const char* end, long long k){
+#ifdef __SSE2__
+	__m128i nl = _mm_set1_epi8('\n');
+	while (end - p >= 32){
+		unsigned int lo = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), nl));
+		unsigned int hi = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), nl));
+		unsigned int mask = lo | hi << 16;
+		int n = __builtin_popcount(mask);
+		if (n >= k){
+			while (--k) mask &= mask - 1;
+			return p + __builtin_ctz(mask) + 1;
+		}
+		k -= n;
+		p += 32;
+	}
+#endif
+	while (p < end){
+		p = memchr(p, '\n', end - p);
+		if (p == NULL) return NULL;
+		p++;
+		if (--k == 0) return p;
+	}
+	return NULL;
+}
+
+// whether some line in p[0..n) ends in \r\n
+int editorHasCRLF(const char* p, long long n){
+	const char* end = p + n;
+	while ((p = memchr(p, '\r', end - p)) && p + 1 < end){
+		if (p[1] == '\n') return 1;
+		p++;
+	}
+	return 0;
+}
+
+#define INDEX_BLOCK 4096 // bytes per newline count kept from the first pass
+
+// A stretch of the file one thread scans. The first pass counts its newlines block by
+// block, the second finds where the index entries that start in it begin, going by those
+// counts, the last checks entries for \r.
+struct indexSlice {
+	pthread_t thread;
+	int threaded;
+	int pass;
+	const char* map;
+	long long size;
+	long long from, to; // bytes of the slice
+	long long lines; // newlines in it
+	int* blocks; // newlines per INDEX_BLOCK of it
+	long long before; // newlines before it
+	int cr; // a \r turned up
+	long long* starts; // offsets of the entries starting in it
+	int nstarts;
+	// entries [k0, k1) of the whole index get their \r checked
+	long long* all;
+	int nall;
+	unsigned char* crlf;
+	int k0, k1;
+};
+
+void* editorIndexWorker(void* arg){
+	struct indexSlice* s = arg;
+	const char* p = s->map + s->from;
+	const char* end = s->map + s->to;
+	if (s->pass == 0){
+		long long nblocks = (s->to - s->from + INDEX_BLOCK - 1) / INDEX_BLOCK;
+		s->blocks = xmalloc(sizeof(int) * (nblocks ? nblocks : 1));
+		for (long long b = 0; b < nblocks; b++){
+			long long len = end - p < INDEX_BLOCK ? end - p : INDEX_BLOCK;
+			s->blocks[b] = editorCountNewlines(p, len, &s->cr);
+			s->lines += s->blocks[b];
+			p += len;
+		}
+	}
+	else if (s->pass == 1){
+		// an entry starts after every WYNAUT_PAGE_LINES-th newline of the file
+		s->starts = xmalloc(sizeof(long long) * (s->lines / WYNAUT_PAGE_LINES + 1));
+		long long done = 0;
+		long long b = 0;
+		long long next = WYNAUT_PAGE_LINES - s->before % WYNAUT_PAGE_LINES;
+		while (next <= s->lines){
+			// only the block the newline is in gets looked at again
+			while (done + s->blocks[b] < next) done += s->blocks[b++];
+			p = editorSkipLines(s->map + s->from + b * INDEX_BLOCK, end, next - done);
+			s->starts[s->nstarts++] = p - s->map;
+			next += WYNAUT_PAGE_LINES;
+		}
+		free(s->blocks);
+	}
+	else{
+		for (int k = s->k0; k < s->k1; k++){
+			long long to = k + 1 < s->nall ? s->all[k + 1] : s->size;
+			s->crlf[k] = editorHasCRLF(s->map + s->all[k], to - s->all[k]);
+		}
+	}
+	return NULL;
+}
+
+// runs a pass over all slices, each on its own thread where one can be had
+void editorIndexRun(struct indexSlice* s, int n, int pass){
+	for (int i = 0; i < n; i++) s[i].pass = pass;
+	for (int i = 1; i < n; i++){
+		s[i].threaded = pthread_create(&s[i].thread, NULL, editorIndexWorker, &s[i]) == 0;
+	}
+	editorIndexWorker(&s[0]);
+	for (int i = 1; i < n; i++){
+		if (s[i].threaded) pthread_join(s[i].thread, NULL);
+		else editorIndexWorker(&s[i]);
+	}
+}
+
+// Indexes the lines of the mapped file as paged out chunks of WYNAUT_PAGE_LINES rows.
+// The file is cut into slices scanned on several threads, their results are merged
+// into the chunk tree afterwards. Returns the number of lines, or -1 without indexing
+// anything when there are more than rows can count.
+long long editorIndexLines(const char* map, long long size){
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	long long n = size / WYNAUT_INDEX_SLICE + 1;
+	if (n > cpus) n = cpus < 1 ? 1 : cpus;
+	if (n > WYNAUT_INDEX_THREADS) n = WYNAUT_INDEX_THREADS;
+	struct indexSlice s[WYNAUT_INDEX_THREADS];
+	memset(s, 0, sizeof(s));
+	for (int i = 0; i < n; i++){
+		s[i].map = map;
+		s[i].size = size;
+		s[i].from = size * i / n;
+		s[i].to = size * (i + 1) / n;
+	}
+
+	editorIndexRun(s, n, 0);
+	long long newlines = 0;
+	int cr = 0;
+	for (int i = 0; i < n; i++){
+		s[i].before = newlines;
+		newlines += s[i].lines;
+		cr |= s[i].cr;
+	}
+	long long nlines = newlines + (map[size - 1] != '\n');
+	if (nlines > INT_MAX) return -1;
+	editorIndexRun(s, n, 1);
+
+	long long* all = xmalloc(sizeof(long long) * (newlines / WYNAUT_PAGE_LINES + 1));
+	int nall = 0;
+	all[nall++] = 0;
+	for (int i = 0; i < n; i++){
+		for (int j = 0; j < s[i].nstarts; j++){
+			// a file ending on a full entry doesn't start another one
+			if (s[i].starts[j] < size) all[nall++] = s[i].starts[j];
+		}
+		free(s[i].starts);
+	}
+
+	// only files with a \r in them need the entries checked for \r\n
+	unsigned char* crlf = xcalloc(nall, 1);
+	if (cr){
+		for (int i = 0; i < n; i++){
+			s[i].all = all;
+			s[i].nall = nall;
+			s[i].crlf = crlf;
+			s[i].k0 = (long long)nall * i / n;
+			s[i].k1 = (long long)nall * (i + 1) / n;
+		}
+		editorIndexRun(s, n, 2);
+	}
+
+	for (int k = 0; k < nall; k++){
+		rowchunk* c = rowChunkStub();
+		c->src = all[k];
+		c->srclen = (k + 1 < nall ? all[k + 1] : size) - all[k];
+		c->n = k + 1 < nall ? WYNAUT_PAGE_LINES : nlines - (long long)WYNAUT_PAGE_LINES * k;
+		// a last line without a newline can't be copied as is either
+		if (crlf[k] || (k + 1 == nall && map[size - 1] != '\n')) c->flags |= CHUNK_CR;
+		rowChunkPull(c);
+		E.rows = rowChunkMerge(E.rows, c);
+	}
+	free(all);
+	free(crlf);
+	return nlines;
+}
+
+// Finds the row holding byte `off` and sets *col to its column there. Text that still
+// matches the file counts the file's bytes, edited rows their length and a newline.
+// Returns -1 past the end.
+int editorOffsetRow(long long off, int* col){
+	long long pos = 0;
+	int line = 0;
+	int nchunks = E.rows ? E.rows->chunks : 0;
+	for (int k = 0; k < nchunks; k++){
+		rowchunk* c = rowChunkNth(k);
+		int clean = c->rows == NULL || !(c->flags & CHUNK_MODIFIED);
+		for (int i = 0; clean && c->rows && i < c->n; i++){
+			if (!(c->rows[i].flags & ROW_MAPPED)) clean = 0;
+		}
+		if (clean && off >= pos + c->srclen){
+			pos += c->srclen;
+			line += c->n;
+			continue;
+		}
+		if (clean){
+			char* own;
+			const char* text = rowChunkText(c, &own);
+			if (text == NULL) return -1;
+			long long rel = off - pos;
+			int dummy = 0;
+			line += editorCountNewlines(text, rel, &dummy);
+			const char* start = text + rel;
+			while (start > text && start[-1] != '\n') start--;
+			*col = text + rel - start;
+			free(own);
+			return line;
+		}
+		for (int i = 0; i < c->n; i++){
+			erow* row = &c->rows[i];
+			if (off <= pos + row->size){
+				*col = off - pos;
+				return line + i;
+			}
+			pos += row->size + 1;
+		}
+		line += c->n;
+	}
+	return -1;
+}
+
+// Ctrl-G, jumps to a line number, or to a byte offset when it starts with @
+void editorGoto(){
+	char* in = editorPrompt("Go to line (@ for a byte offset): %s", NULL);
+	if (in == NULL) return;
+	char* num = in[0] == '@' ? in + 1 : in;
+	char* end;
+	errno = 0;
+	// lines are decimal whatever zeros they start with, offsets can be hex with 0x too
+	int hex = in[0] == '@' && num[0] == '0' && (num[1] == 'x' || num[1] == 'X');
+	long long n = strtoll(num, &end, hex ? 16 : 10);
+	if (end == num || *end || errno || n < 0){
+		editorSetStatusMessage("Not a line or an offset: %s", in);
+	}
+	else if (in[0] == '@'){
+		int col;
+		int at = editorOffsetRow(n, &col);
+		if (at == -1){
+			editorSetStatusMessage("Offset %lld is past the end", n);
+		}
+		else{
+			// an offset on the \r of a \r\n lands at the end of the row
+			int size = editorRowAt(at)->size;
+			E.cy = at;
+			E.cx = col < size ? col : size;
+			E.rowoff = E.numrows;
+		}
+	}
+	else if (E.numrows > 0){
+		E.cy = n < 1 ? 0 : n > E.numrows ? E.numrows - 1 : n - 1;
+		E.cx = 0;
+		E.rowoff = E.numrows;
+	}
+	free(in);
+}
+
+/** file i/o **/
+
+// maps the file and indexes its lines, one paged out chunk per WYNAUT_PAGE_LINES of them
+// rows are only built when a chunk is first needed, see rowChunkLoad and editorIndexLines
+// returns -1 if the file can't be mapped (pipes, empty files) so the caller can fall back,
+// -2 if it has more lines than rows are counted in
+int editorMapFile(int fd){
+	struct stat st;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) return -1;
+
+	char* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) return -1;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	long long nlines = editorIndexLines(map, st.st_size);
+	if (nlines < 0){
+		munmap(map, st.st_size);
+		return -2;
+	}
+	E.numrows = nlines;
+	E.map = map;
+	E.maplen = st.st_size;
+	return 0;
+}
+
+// opens a file and loads it into editorConfig
+void editorOpen(char* filename) {
+	editorUndoReset();
+	free(E.filename);
+	E.filename = xstrdup(filename); // copies given string and dynamically allocates memory
+
+	editorSelectSyntaxHighlight();
+
+	FILE* fp = fopen(filename,"r");
+	if (!fp) die("fopen");
+
+	// Regular files are mapped and loaded lazily, everything else goes through getline
+	int mapped = editorMapFile(fileno(fp));
+	if (mapped == 0){
+		fclose(fp);
+		editorSyntaxInvalidate(0, E.numrows);
+		E.dirty = 0;
+		return;
+	}
+
+	char* line = NULL;
+	size_t linecap = 0;
+	ssize_t linelen;
+	E.undo.paused = 1;
+	while (mapped != -2 && (linelen = xgetline(&line, &linecap, fp)) != -1){
+		while (linelen>0 && (line[linelen-1] == '\n' || line[linelen-1] == '\r'))
+			linelen--;
+		if (E.numrows == INT_MAX) mapped = -2;
+		else editorInsertRow(E.numrows, line, linelen);
+	}
+	if (mapped == -2){
+		// rows are counted in ints. Whatever got loaded has no name, so it can't be
+		// saved over the file.
+		editorSetStatusMessage("Can't open %s: more than %d lines", E.filename, INT_MAX);
+		free(E.filename);
+		E.filename = NULL;
+	}
+	E.undo.paused = 0;
+	free(line);
+	fclose(fp);
+	E.dirty = 0;
+}
+
+// writes n iovecs, going again wherever writev stops short, returns -1 on error
+int editorWritev(int fd, struct iovec* v, int n){
+	while (n > 0){
+		ssize_t w = writev(fd, v, n);
+		if (w == -1){
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		while (n > 0 && (size_t)w >= v->iov_len){
+			w -= v->iov_len;
+			v++;
+			n--;
+		}
+		if (n > 0){
+			v->iov_base = (char*)v->iov_base + w;
+			v->iov_len -= w;
+		}
+	}
+	return 0;
+}
+
+// writes the iovecs gathered so far and moves the save's progress along, waking the
+// main thread up each time there is another percent to show
+int editorSaveFlush(int fd, struct editorSaving* s, struct iovec* iov, int* n, long long* total){
+	long long before = *total;
+	for (int i = 0; i < *n; i++) *total += iov[i].iov_len;
+	int r = editorWritev(fd, iov, *n);
+	*n = 0;
+	__atomic_store_n(&s->written, *total, __ATOMIC_RELAXED);
+	if (s->total && before * 100 / s->total != *total * 100 / s->total){
+		if (write(worker.pipe[1], "", 1) == -1){}
+	}
+	return r;
+}
+
+// Writes the snapshot to fd, merging rows in memory with the untouched stretches of the
+// file mapping and the rows paged out to the scratch file, a batch of iovecs per writev.
+// Returns the number of bytes written or -1 on error.
+long long editorWriteRows(int fd, struct editorSaving* s){
+	struct iovec iov[WYNAUT_SAVE_IOV];
+	int n = 0;
+	int err = 0;
+	long long total = 0;
+	char* copy = NULL;
+	for (int i = 0; !err && i < s->npieces; i++){
+		struct savePiece* pc = &s->pieces[i];
+		if (pc->kind == PIECE_SCRATCH){
+			// copied over from the scratch file a block at a time
+			err = editorSaveFlush(fd, s, iov, &n, &total);
+			if (copy == NULL) copy = xmalloc(WYNAUT_SAVE_COPY);
+			long long done = 0;
+			while (!err && done < pc->len){
+				long long len = pc->len - done < WYNAUT_SAVE_COPY ? pc->len - done : WYNAUT_SAVE_COPY;
+				err = editorPread(s->scratchfd, copy, len, pc->off + done);
+				iov[0].iov_base = copy;
+				iov[0].iov_len = len;
+				n = 1;
+				if (!err) err = editorSaveFlush(fd, s, iov, &n, &total);
+				done += len;
+			}
+		}
+		else if (pc->kind == PIECE_LINES){
+			const char* p = pc->p;
+			const char* end = p + pc->len;
+			while (!err && p < end){
+				if (n + 2 > WYNAUT_SAVE_IOV) err = editorSaveFlush(fd, s, iov, &n, &total);
+				int len;
+				const char* next = editorNextLine(p, end, &len);
+				iov[n].iov_base = (char*)p;
+				iov[n++].iov_len = len;
+				iov[n].iov_base = "\n";
+				iov[n++].iov_len = 1;
+				p = next;
+			}
+		}
+		else{
+			if (n + 2 > WYNAUT_SAVE_IOV) err = editorSaveFlush(fd, s, iov, &n, &total);
+			iov[n].iov_base = (char*)pc->p;
+			iov[n++].iov_len = pc->len;
+			// a row takes two iovecs, its chars and the newline
+			if (pc->kind == PIECE_ROW){
+				iov[n].iov_base = "\n";
+				iov[n++].iov_len = 1;
+			}
+		}
+	}
+	if (!err) err = editorSaveFlush(fd, s, iov, &n, &total);
+	free(copy);
+	return err ? -1 : total;
+}
+
+// Runs the save on its own thread. The rows are written to a temporary file next to the
+// target which is then renamed over it, so a crash halfway through leaves the old file
+// intact. It also keeps the old inode alive for rows still borrowing from the mapping.
+void* editorSaveWorker(void* arg){
+	struct editorSaving* s = arg;
+
+	// write through symlinks instead of replacing them
+	char* target = xrealpath(s->filename);
+	if (target == NULL) target = xstrdup(s->filename);
+
+	// the temp file has to live in the same directory for rename to be atomic
+	size_t tlen = strlen(target);
+	char* tmp = xmalloc(tlen + 16);
+	char* slash = strrchr(target, '/');
+	int dirlen = slash ? slash - target + 1 : 0;
+	snprintf(tmp, tlen + 16, "%.*s.%s.XXXXXX", dirlen, target, target + dirlen);
+
+	// new files get the usual 0666 minus umask, existing ones keep their mode
+	struct stat st;
+	mode_t mode = stat(target, &st) == 0 ? st.st_mode & 07777 : s->newmode;
+
+	long long len = -1;
+	int fd = mkstemp(tmp);
+	if (fd != -1){
+		if (fchmod(fd, mode) != -1) len = editorWriteRows(fd, s);
+		if (len != -1 && s->fsync != FSYNC_NONE && fsync(fd) == -1) len = -1;
+		if (close(fd) == -1) len = -1;
+		if (len != -1 && rename(tmp, target) == -1) len = -1;
+		if (len == -1) unlink(tmp);
+	}
+	s->err = len == -1 ? errno : 0;
+
+	if (len != -1 && s->fsync == FSYNC_DIR){
+		char* dir = dirlen ? xstrndup(target, dirlen) : xstrdup(".");
+		int dirfd = open(dir, O_RDONLY);
+		if (dirfd != -1){
+			fsync(dirfd);
+			close(dirfd);
+		}
+		free(dir);
+	}
+	free(tmp);
+	free(target);
+
+	__atomic_store_n(&s->done, 1, __ATOMIC_RELEASE);
+	if (write(worker.pipe[1], "", 1) == -1){}
+	return NULL;
+}
+
+// chars a running save may still be writing, freed when it is done
+// cap is what rowmem gave them, -1 for buffers from malloc
+void editorSaveDefer(char* chars, int cap){
+	struct editorSaving* s = E.saving;
+	if (s->ndeferred == s->capdeferred){
+		s->capdeferred = s->capdeferred ? s->capdeferred * 2 : 256;
+		s->deferred = xrealloc(s->deferred, sizeof(char*) * s->capdeferred);
+		s->deferred_cap = xrealloc(s->deferred_cap, sizeof(int) * s->capdeferred);
+	}
+	s->deferred[s->ndeferred] = chars;
+	s->deferred_cap[s->ndeferred++] = cap;
+}
+
+// Waits for the running save and wraps it up. What it wrote is the file's clean state from
+// now on, edits made since then keep the file marked as modified.
+void editorSaveFinish(){
+	struct editorSaving* s = E.saving;
+	if (s->threaded) pthread_join(s->thread, NULL);
+	E.saving = NULL;
+
+	for (int i = 0; i < s->ndeferred; i++){
+		if (s->deferred_cap[i] < 0) free(s->deferred[i]);
+		else rowmemFree(s->deferred[i], s->deferred_cap[i]);
+	}
+	for (int k = 0; E.rows && k < E.rows->chunks; k++){
+		rowchunk* c = rowChunkNth(k);
+		for (int i = 0; c->rows && i < c->n; i++) c->rows[i].flags &= ~ROW_PINNED;
+	}
+
+	if (s->err){
+		editorSetStatusMessage("Can't save! I/O error: %s", strerror(s->err));
+	}
+	else{
+		double ms = (editorMicros() - s->start) / 1e3;
+		E.undo.clean = s->undo_top;
+		if (E.edits == s->edits || E.undo.top == E.undo.clean) E.dirty = 0;
+		else if (E.dirty == 0) E.dirty = 1;
+		editorSetStatusMessage("%lld bytes written to disk in %.1f ms (%.1f MB/s)", s->written, ms,
+			ms > 0 ? s->written / (ms * 1e3) : 0.0);
+	}
+
+	free(s->pieces);
+	free(s->filename);
+	free(s->deferred);
+	free(s->deferred_cap);
+	free(s);
+}
+
+// Shows how far the running save got, and finishes it once the thread is done. Saves
+// of the buffers that aren't shown are finished here too, their rows stay pinned and
+// the buffer modified until then. Not while fuzzy find is open, its workers read E.
+void editorSaveIdle(){
+	for (int k = 0; k < buffers.n && !E.fuzzy; k++){
+		struct editorSaving* other = buffers.list[k].saving;
+		if (k == buffers.cur || other == NULL || !__atomic_load_n(&other->done, __ATOMIC_ACQUIRE)) continue;
+		int cur = buffers.cur;
+		editorBufferUse(k);
+		editorSaveFinish();
+		editorBufferUse(cur);
+		editorRefreshScreen();
+	}
+
+	struct editorSaving* s = E.saving;
+	if (s == NULL) return;
+	// a replay waits for it right away, so the save key is timed with the disk
+	if (E.replay || __atomic_load_n(&s->done, __ATOMIC_ACQUIRE)){
+		editorSaveFinish();
+		editorRefreshScreen();
+		return;
+	}
+	long long written = __atomic_load_n(&s->written, __ATOMIC_RELAXED);
+	int pct = s->total ? written * 100 / s->total : 0;
+	if (pct > 100) pct = 100;
+	if (pct == s->shown) return;
+	s->shown = pct;
+	editorSetStatusMessage("Saving %s... %d%%", s->filename, pct);
+	editorRefreshScreen();
+}
+
+// Saves to file without holding up editing. The rows' chars are gathered into a snapshot
+// and pinned, a thread writes them out while edits give pinned rows fresh chars.
+void editorSave(){
+	if (E.saving){
+		editorSetStatusMessage("Still saving %s", E.saving->filename);
+		return;
+	}
+	if(E.filename == NULL){
+        E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
+        if (E.filename == NULL){
+            editorSetStatusMessage("Save aborted");
+            return;
+        }
+		editorSelectSyntaxHighlight();
+    }
+
+	struct editorSaving* s = xcalloc(1, sizeof(struct editorSaving));
+	s->start = editorMicros();
+	// chunks that are paged out go in whole, without being paged in
+	int nchunks = E.rows ? E.rows->chunks : 0;
+	int npieces = 0;
+	for (int k = 0; k < nchunks; k++){
+		rowchunk* c = rowChunkNth(k);
+		npieces += c->rows ? c->n : 1;
+	}
+	s->pieces = xmalloc(sizeof(struct savePiece) * (npieces ? npieces : 1));
+	for (int k = 0; k < nchunks; k++){
+		rowchunk* c = rowChunkNth(k);
+		if (c->rows == NULL){
+			struct savePiece* pc = &s->pieces[s->npieces++];
+			pc->kind = c->flags & CHUNK_SPILLED ? PIECE_SCRATCH : c->flags & CHUNK_CR ? PIECE_LINES : PIECE_RAW;
+			pc->p = E.map + c->src;
+			pc->off = c->src;
+			pc->len = c->srclen;
+			s->total += c->srclen;
+			continue;
+		}
+		for (int i = 0; i < c->n; i++){
+			erow* row = &c->rows[i];
+			struct savePiece* pc = &s->pieces[s->npieces++];
+			pc->kind = PIECE_ROW;
+			pc->p = row->chars;
+			pc->len = row->size;
+			s->total += row->size + 1;
+			// mapped chars never change, only heap ones need pinning
+			if (!(row->flags & ROW_MAPPED)) row->flags |= ROW_PINNED;
+		}
+	}
+	s->filename = xstrdup(E.filename);
+	s->scratchfd = E.page.scratchfd;
+	s->fsync = E.save_fsync;
+	s->newmode = E.save_mode;
+	s->edits = E.edits;
+	s->undo_top = E.undo.top;
+	s->shown = -1;
+	// typing after this starts a new undo step, so the saved state has one of its own
+	editorUndoBreak();
+
+	E.saving = s;
+	s->threaded = pthread_create(&s->thread, NULL, editorSaveWorker, s) == 0;
+	// no thread to be had, the save happens right here
+	if (!s->threaded) editorSaveWorker(s);
+	editorSaveIdle();
+}
+
+/** buffers **/
+
+// sets up E for a file that has nothing loaded yet, the budgets stay as they are
+void editorBufferInit(){
+	E.cx = 0;
+	E.cy = 0;
+	E.rx = 0;
+	E.rowoff = 0;
+	E.coloff = 0;
+	E.numrows = 0;
+	E.rows = NULL;
+	E.dirty = 0;
+	E.edits = 0;
+	E.filename = NULL;
+	E.map = NULL;
+	E.maplen = 0;
+	E.syntax = NULL;
+	E.hlgen = 0;
+	E.syn_lo = E.syn_hi = 0;
+	E.cache_bytes = 0;
+	E.search = NULL;
+	E.fuzzy = NULL;
+	E.saving = NULL;
+	E.undo.log = NULL;
+	E.undo.paused = 0;
+	editorUndoReset();
+	E.page.bytes = 0;
+	E.page.clock = 0;
+	E.page.scratchfd = -1;
+	E.page.scratchlen = 0;
+	E.page.loads = 0;
+	E.page.spills = 0;
+}
+
+// Puts buffer k in E. What belongs to the terminal rather than to a file stays as it is.
+void editorBufferLoad(int k){
+	struct editorConfig b = buffers.list[k];
+	b.screenrows = E.screenrows;
+	b.screencols = E.screencols;
+	memcpy(b.statusmsg, E.statusmsg, sizeof(b.statusmsg));
+	b.statusmsg_time = E.statusmsg_time;
+	b.save_fsync = E.save_fsync;
+	b.save_mode = E.save_mode;
+	b.frame = E.frame;
+	b.framelines = E.framelines;
+	b.frame_cy = E.frame_cy;
+	b.frame_cx = E.frame_cx;
+	b.frame_bytes = E.frame_bytes;
+	b.total_frame_bytes = E.total_frame_bytes;
+	b.infd = E.infd;
+	b.outfd = E.outfd;
+	b.replay = E.replay;
+	b.orig_termios = E.orig_termios;
+	b.undo.budget = E.undo.budget;
+	b.page.budget = E.page.budget;
+	E = b;
+	buffers.cur = k;
+}
+
+// switches E over to buffer k, the one in E is put away
+void editorBufferUse(int k){
+	if (k == buffers.cur) return;
+	buffers.list[buffers.cur] = E;
+	editorBufferLoad(k);
+}
+
+// Lets go of everything the file in E holds, a save still running is finished first
+void editorBufferFree(){
+	if (E.saving) editorSaveFinish();
+	int n = E.rows ? E.rows->chunks : 0;
+	rowchunk** chunks = xmalloc(sizeof(rowchunk*) * (n ? n : 1));
+	for (int k = 0; k < n; k++) chunks[k] = rowChunkNth(k);
+	for (int k = 0; k < n; k++){
+		for (int i = 0; chunks[k]->rows && i < chunks[k]->n; i++) editorFreeRow(&chunks[k]->rows[i]);
+		rowChunkFree(chunks[k]);
+	}
+	free(chunks);
+	if (E.map) munmap(E.map, E.maplen);
+	if (E.page.scratchfd != -1) close(E.page.scratchfd);
+	free(E.undo.log);
+	E.undo.log = NULL;
+	free(E.filename);
+}
+
+// opens a file in a new buffer and switches to it
+void editorBufferAdd(char* filename){
+	if (buffers.n == buffers.cap){
+		buffers.cap *= 2;
+		buffers.list = xrealloc(buffers.list, sizeof(struct editorConfig) * buffers.cap);
+	}
+	buffers.list[buffers.cur] = E;
+	buffers.cur = buffers.n++;
+	editorBufferInit();
+	editorOpen(filename);
+}
+
+// The buffer that has file `name` open, -1 if none has. Paths are compared resolved,
+// so a.c, ./a.c and the full path are the same file.
+int editorBufferFind(const char* name){
+	char* path = xrealpath(name);
+	int found = -1;
+	for (int k = 0; k < buffers.n && found < 0; k++){
+		char* open = k == buffers.cur ? E.filename : buffers.list[k].filename;
+		if (open == NULL) continue;
+		if (!strcmp(open, name)) found = k;
+		else if (path){
+			char* other = xrealpath(open);
+			if (other && !strcmp(other, path)) found = k;
+			free(other);
+		}
+	}
+	free(path);
+	return found;
+}
+
+// Ctrl-O, switches to the file if it is open already
+void editorBufferOpen(){
+	char* name = editorPrompt("Open: %s (ESC to cancel)", NULL);
+	if (name == NULL) return;
+	int k = editorBufferFind(name);
+	if (k >= 0){
+		editorBufferUse(k);
+	}
+	else if (access(name, R_OK) == -1){
+		editorSetStatusMessage("Can't open %s: %s", name, strerror(errno));
+	}
+	else{
+		editorBufferAdd(name);
+		// a file that didn't load has said why already
+		if (E.filename) editorSetStatusMessage("%s [%d/%d]", E.filename, buffers.cur + 1, buffers.n);
+	}
+	free(name);
+}
+
+// Ctrl-N and Ctrl-B, goes to the next or the previous buffer
+void editorBufferSwitch(int direction){
+	if (buffers.n == 1) return;
+	editorBufferUse((buffers.cur + direction + buffers.n) % buffers.n);
+	editorSetStatusMessage("%s [%d/%d]", E.filename ? E.filename : "[No name]", buffers.cur + 1, buffers.n);
+}
+
+// Ctrl-W, closing the last buffer leaves an empty one
+void editorBufferClose(){
+	editorBufferFree();
+	if (buffers.n == 1){
+		editorBufferInit();
+		return;
+	}
+	int k = buffers.cur;
+	memmove(&buffers.list[k], &buffers.list[k + 1], sizeof(struct editorConfig) * (buffers.n - k - 1));
+	buffers.n--;
+	editorBufferLoad(k < buffers.n ? k : buffers.n - 1);
+}
+
+// how many open files have unsaved changes
+int editorBuffersDirty(){
+	int n = E.dirty != 0;
+	for (int k = 0; k < buffers.n; k++){
+		if (k != buffers.cur && buffers.list[k].dirty) n++;
+	}
+	return n;
+}
+
+// waits for the saves still running in every buffer, before quitting
+void editorBuffersFinish(){
+	int cur = buffers.cur;
+	for (int k = 0; k < buffers.n; k++){
+		editorBufferUse(k);
+		if (E.saving) editorSaveFinish();
+	}
+	editorBufferUse(cur);
+}
+
+/** regex **/
+
+// Regex search. The pattern is parsed straight into a Thompson NFA, which becomes a DFA
+// lazily: a DFA state is the set of NFA states the bytes so far can leave the pattern in,
+// and its transition on a byte is worked out the first time the byte is seen there.
+// Finding every match in a row takes time linear in its length, whatever the pattern
+// looks like, see regexFind.
+//
+// Literals, . [] [^] with ranges, * + ? | () ^ $ and \d \w \s \D \W \S are understood,
+// a backslash before anything else makes it literal. Matches are leftmost-longest and
+// never empty.
+
+enum regexOp {
+	RE_CLASS = 0, // consumes a byte of the node's class
+	RE_SPLIT, // goes on to out and out1
+	RE_JUMP, // goes on to out
+	RE_BOL, // only at the start of the row
+	RE_EOL, // only at its end
+	RE_MATCH
+};
+
+struct regexNode {
+	unsigned char op;
+	int out, out1;
+	int cls; // index into the pattern's classes for RE_CLASS
+};
+
+#define REGEX_ACCEPT (1<<0) // a match ends where this state is reached
+#define REGEX_ACCEPT_EOL (1<<1) // one does if the row ends there
+#define REGEX_DEAD (1<<2) // no match can come out of this state
+#define REGEX_START (1<<3) // live DFA: a match starts here, in the middle of the row
+#define REGEX_START_BOL (1<<4) // the same at the start of the row
+
+#define REGEX_LIVE_START 0x8000 // liveat: a match starts at this position, the rest is the live state
+#define REGEX_ALIVE_MEMO 4096 // entries of the memo regexAlive keeps, a power of two
+
+// The DFA states worked out so far. The cache is dropped and rebuilt when it reaches
+// WYNAUT_REGEX_STATES, so a pattern that blows up only costs time, not memory.
+struct regexDFA {
+	int unanchored; // a match may start at any byte, the start state is added after each
+	int** sets; // NFA states of each DFA state, sorted, with the count in front
+	unsigned char* flags; // REGEX_*
+	int* next; // nstates * nbytecls transitions, -1 where not known yet
+	int nstates;
+	int* hash; // open addressing over the states, -1 for empty
+	int start[2]; // start state in the middle of a row and at its start, -1 until known
+	int flushes;
+};
+
+struct regex {
+	struct regexNode* nodes;
+	int nnodes, capnodes;
+	unsigned int (*classes)[8]; // 256 bit sets of bytes
+	int nclasses, capclasses;
+	int startnode;
+	unsigned char bytecls[256]; // bytes no class tells apart share a class, transitions go by class
+	unsigned char byterep[256]; // a byte of each class
+	int nbytecls;
+	char prefix[64]; // every match starts with these bytes
+	int prefixlen;
+	unsigned int first[8]; // bytes a match can start with
+	int nullable; // the pattern matches the empty string, so the search DFA can't rule rows out
+	int matchnode;
+	int* startcls[2]; // byte consuming nodes a match starts with in the middle of a row and at its start, count in front
+	struct regexDFA search, anchored;
+	struct regexDFA live; // run backward, its states are the nodes that can still lead to a match
+	const char* rowtext; // row being searched, see regexFind
+	int rowlen;
+	int rowbudget; // bytes the anchored DFA may still read in it before the backward pass is made
+	int rowlive; // the backward pass was made, liveat covers livefrom to rowlen
+	unsigned short* liveat; // live state and REGEX_LIVE_START of each position
+	int capliveat;
+	int livefrom;
+	int livetop; // positions past this got their state before the live DFA was flushed
+	unsigned int* alive; // memo of regexAlive
+	int aliveflushes[2]; // flushes of the anchored and live DFA when the memo was started
+	int* mark; // visited marks while building a set
+	int markgen;
+	int* member; // marks of the nodes in a set, to test membership
+	int membergen;
+	int* stack;
+	int* set; // scratch for the set being built
+	int* eolset;
+};
+
+struct regexFrag {
+	int start;
+	int end; // an RE_JUMP node whose out is still to be filled in
+};
+
+struct regexParser {
+	struct regex* re;
+	const char* p;
+	const char* err;
+	int depth; // parentheses open
+	int prefixopen; // the pattern so far is a literal, so it can still grow the prefix
+};
+
+int regexNode(struct regex* re, int op, int out, int out1){
+	if (re->nnodes == re->capnodes){
+		re->capnodes = re->capnodes ? re->capnodes * 2 : 32;
+		re->nodes = xrealloc(re->nodes, sizeof(struct regexNode) * re->capnodes);
+	}
+	struct regexNode* n = &re->nodes[re->nnodes];
+	n->op = op;
+	n->out = out;
+	n->out1 = out1;
+	n->cls = -1;
+	return re->nnodes++;
+}
+
+int regexClass(struct regex* re){
+	if (re->nclasses == re->capclasses){
+		re->capclasses = re->capclasses ? re->capclasses * 2 : 16;
+		re->classes = xrealloc(re->classes, sizeof(re->classes[0]) * re->capclasses);
+	}
+	memset(re->classes[re->nclasses], 0, sizeof(re->classes[0]));
+	return re->nclasses++;
+}
+
+void regexClassAdd(unsigned int* cls, int lo, int hi){
+	for (int b = lo; b <= hi; b++) cls[b >> 5] |= 1u << (b & 31);
+}
+
+int regexClassHas(const unsigned int* cls, int b){
+	return (cls[b >> 5] >> (b & 31)) & 1;
+}
+
+// adds the bytes of \d \w \s (or their complements) to cls, returns 0 for other letters
+int regexClassEscape(unsigned int* cls, char c){
+	unsigned int tmp[8] = {0};
+	switch (tolower((unsigned char)c)){
+		case 'd':
+			regexClassAdd(tmp, '0', '9');
+			break;
+		case 'w':
+			regexClassAdd(tmp, '0', '9');
+			regexClassAdd(tmp, 'a', 'z');
+			regexClassAdd(tmp, 'A', 'Z');
+			regexClassAdd(tmp, '_', '_');
+			break;
+		case 's':
+			regexClassAdd(tmp, ' ', ' ');
+			regexClassAdd(tmp, '\t', '\r');
+			break;
+		default:
+			return 0;
+	}
+	for (int k = 0; k < 8; k++) cls[k] |= isupper((unsigned char)c) ? ~tmp[k] : tmp[k];
+	return 1;
+}
+
+// a fragment consuming one byte of class cls
+struct regexFrag regexFragClass(struct regex* re, int cls){
+	struct regexFrag f;
+	f.end = regexNode(re, RE_JUMP, -1, -1);
+	f.start = regexNode(re, RE_CLASS, f.end, -1);
+	re->nodes[f.start].cls = cls;
+	return f;
+}
+
+struct regexFrag regexParseAlt(struct regexParser* ps);
+
+// Parses one atom. *lit is set to its byte if it is a plain literal, -1 otherwise.
+struct regexFrag regexParseAtom(struct regexParser* ps, int* lit){
+	struct regex* re = ps->re;
+	struct regexFrag f;
+	*lit = -1;
+	char c = *ps->p++;
+	if (c == '('){
+		ps->depth++;
+		f = regexParseAlt(ps);
+		if (*ps->p != ')'){
+			if (!ps->err) ps->err = "missing )";
+			return f;
+		}
+		ps->p++;
+		ps->depth--;
+		return f;
+	}
+	if (c == '^' || c == '$'){
+		f.end = regexNode(re, RE_JUMP, -1, -1);
+		f.start = regexNode(re, c == '^' ? RE_BOL : RE_EOL, f.end, -1);
+		return f;
+	}
+	if (c == '*' || c == '+' || c == '?'){
+		ps->err = "nothing to repeat";
+		return regexFragClass(re, regexClass(re));
+	}
+
+	int k = regexClass(re);
+	unsigned int* cls = re->classes[k];
+	if (c == '.'){
+		regexClassAdd(cls, 0, 255);
+	}
+	else if (c == '['){
+		int negate = *ps->p == '^';
+		if (negate) ps->p++;
+		// a ']' right after the '[' is a literal
+		int first = 1;
+		while (*ps->p && (*ps->p != ']' || first)){
+			first = 0;
+			int lo = (unsigned char)*ps->p++;
+			if (lo == '\\' && *ps->p){
+				if (regexClassEscape(cls, *ps->p)){
+					ps->p++;
+					continue;
+				}
+				lo = (unsigned char)*ps->p++;
+				if (lo == 't') lo = '\t';
+			}
+			int hi = lo;
+			if (ps->p[0] == '-' && ps->p[1] && ps->p[1] != ']'){
+				hi = (unsigned char)ps->p[1];
+				ps->p += 2;
+				if (hi == '\\' && *ps->p) hi = (unsigned char)*ps->p++;
+				if (hi < lo){
+					ps->err = "bad range";
+					hi = lo;
+				}
+			}
+			regexClassAdd(cls, lo, hi);
+		}
+		if (*ps->p != ']') ps->err = "missing ]";
+		else ps->p++;
+		if (negate) for (int j = 0; j < 8; j++) cls[j] = ~cls[j];
+	}
+	else if (c == '\\'){
+		c = *ps->p;
+		if (c == '\0') ps->err = "trailing \\";
+		else{
+			ps->p++;
+			if (!regexClassEscape(cls, c)){
+				*lit = c == 't' ? '\t' : (unsigned char)c;
+				regexClassAdd(cls, *lit, *lit);
+			}
+		}
+	}
+	else{
+		*lit = (unsigned char)c;
+		regexClassAdd(cls, *lit, *lit);
+	}
+	return regexFragClass(re, k);
+}
+
+// parses atoms with their * + ? up to a | or ) and chains them
+struct regexFrag regexParseConcat(struct regexParser* ps){
+	struct regex* re = ps->re;
+	struct regexFrag f;
+	f.start = f.end = regexNode(re, RE_JUMP, -1, -1);
+	while (*ps->p && *ps->p != '|' && *ps->p != ')' && !ps->err){
+		int anchor = *ps->p == '^';
+		int lit;
+		struct regexFrag a = regexParseAtom(ps, &lit);
+		int repeats = 0, plus = 0;
+		while (*ps->p == '*' || *ps->p == '+' || *ps->p == '?'){
+			char q = *ps->p++;
+			int split = regexNode(re, RE_SPLIT, a.start, -1);
+			int end = regexNode(re, RE_JUMP, -1, -1);
+			re->nodes[split].out1 = end;
+			re->nodes[a.end].out = q == '?' ? end : split;
+			// a+ still has to go through a once
+			if (q != '+') a.start = split;
+			a.end = end;
+			repeats++;
+			plus = q == '+';
+		}
+		re->nodes[f.end].out = a.start;
+		f.end = a.end;
+
+		// the leading literals of the pattern are the prefix, a literal that has to
+		// appear at least once ends it
+		if (ps->prefixopen && ps->depth == 0){
+			if (lit >= 0 && (repeats == 0 || (repeats == 1 && plus)) && re->prefixlen < (int)sizeof(re->prefix)){
+				re->prefix[re->prefixlen++] = lit;
+				if (repeats) ps->prefixopen = 0;
+			}
+			else if (!(anchor && repeats == 0)) ps->prefixopen = 0;
+		}
+		else ps->prefixopen = 0;
+	}
+	return f;
+}
+
+struct regexFrag regexParseAlt(struct regexParser* ps){
+	struct regex* re = ps->re;
+	struct regexFrag f = regexParseConcat(ps);
+	while (*ps->p == '|' && !ps->err){
+		ps->p++;
+		// with alternatives no byte is certain to come first
+		ps->prefixopen = 0;
+		if (ps->depth == 0) re->prefixlen = 0;
+		struct regexFrag b = regexParseConcat(ps);
+		int split = regexNode(re, RE_SPLIT, f.start, b.start);
+		int end = regexNode(re, RE_JUMP, -1, -1);
+		re->nodes[f.end].out = end;
+		re->nodes[b.end].out = end;
+		f.start = split;
+		f.end = end;
+	}
+	return f;
+}
+
+// Adds node n and what it reaches without consuming a byte to set. BOL passes only at
+// the start of the row, EOL only at its end. An EOL that can't pass yet stays in the
+// set so the end of the row can be checked later.
+void regexClosure(struct regex* re, int n, int bol, int eol, int* set){
+	int top = 0;
+	re->stack[top++] = n;
+	while (top){
+		n = re->stack[--top];
+		if (n < 0 || re->mark[n] == re->markgen) continue;
+		re->mark[n] = re->markgen;
+		struct regexNode* node = &re->nodes[n];
+		switch (node->op){
+			case RE_SPLIT:
+				re->stack[top++] = node->out1;
+				re->stack[top++] = node->out;
+				break;
+			case RE_JUMP:
+				re->stack[top++] = node->out;
+				break;
+			case RE_BOL:
+				if (bol) re->stack[top++] = node->out;
+				break;
+			case RE_EOL:
+				if (eol) re->stack[top++] = node->out;
+				else set[++set[0]] = n;
+				break;
+			default:
+				set[++set[0]] = n;
+		}
+	}
+}
+
+void regexDFAFlush(struct regexDFA* d){
+	for (int k = 0; k < d->nstates; k++) free(d->sets[k]);
+	d->nstates = 0;
+	memset(d->hash, -1, sizeof(int) * 2 * WYNAUT_REGEX_STATES);
+	d->start[0] = d->start[1] = -1;
+	d->flushes++;
+}
+
+void regexDFAInit(struct regexDFA* d, int nbytecls, int unanchored){
+	memset(d, 0, sizeof(struct regexDFA));
+	d->unanchored = unanchored;
+	d->sets = xmalloc(sizeof(int*) * WYNAUT_REGEX_STATES);
+	d->flags = xmalloc(WYNAUT_REGEX_STATES);
+	d->next = xmalloc(sizeof(int) * WYNAUT_REGEX_STATES * nbytecls);
+	d->hash = xmalloc(sizeof(int) * 2 * WYNAUT_REGEX_STATES);
+	memset(d->hash, -1, sizeof(int) * 2 * WYNAUT_REGEX_STATES);
+	d->start[0] = d->start[1] = -1;
+}
+
+// Returns the DFA state for the NFA states in set, making it if it is new
+int regexDFAState(struct regex* re, struct regexDFA* d, int* set){
+	// sort so the same states always make the same set
+	int n = set[0];
+	for (int i = 2; i <= n; i++){
+		int v = set[i], j = i;
+		for (; j > 1 && set[j - 1] > v; j--) set[j] = set[j - 1];
+		set[j] = v;
+	}
+	unsigned int h = 2166136261u;
+	for (int i = 0; i <= n; i++) h = (h ^ set[i]) * 16777619u;
+	int mask = 2 * WYNAUT_REGEX_STATES - 1;
+	int slot = h & mask;
+	for (; d->hash[slot] >= 0; slot = (slot + 1) & mask){
+		int* s = d->sets[d->hash[slot]];
+		if (s[0] == n && !memcmp(s, set, sizeof(int) * (n + 1))) return d->hash[slot];
+	}
+
+	if (d->nstates == WYNAUT_REGEX_STATES){
+		regexDFAFlush(d);
+		slot = h & mask;
+	}
+	int k = d->nstates++;
+	d->hash[slot] = k;
+	d->sets[k] = xmalloc(sizeof(int) * (n + 1));
+	memcpy(d->sets[k], set, sizeof(int) * (n + 1));
+	for (int c = 0; c < re->nbytecls; c++) d->next[k * re->nbytecls + c] = -1;
+
+	unsigned char flags = n == 0 ? REGEX_DEAD : 0;
+	re->markgen++;
+	re->eolset[0] = 0;
+	for (int i = 1; i <= n; i++){
+		if (re->nodes[set[i]].op == RE_MATCH) flags |= REGEX_ACCEPT;
+		if (re->nodes[set[i]].op == RE_EOL) regexClosure(re, re->nodes[set[i]].out, 0, 1, re->eolset);
+	}
+	for (int i = 1; i <= re->eolset[0]; i++){
+		if (re->nodes[re->eolset[i]].op == RE_MATCH) flags |= REGEX_ACCEPT_EOL;
+	}
+	d->flags[k] = flags;
+	return k;
+}
+
+// start state at the start of a row or in its middle
+int regexStart(struct regex* re, struct regexDFA* d, int bol){
+	if (d->start[bol] < 0){
+		re->markgen++;
+		re->set[0] = 0;
+		regexClosure(re, re->startnode, bol, 0, re->set);
+		int k = regexDFAState(re, d, re->set);
+		d->start[bol] = k;
+	}
+	return d->start[bol];
+}
+
+// the state after byte b in state k
+int regexStep(struct regex* re, struct regexDFA* d, int k, unsigned char b){
+	int c = re->bytecls[b];
+	int next = d->next[k * re->nbytecls + c];
+	if (next >= 0) return next;
+
+	int* from = d->sets[k];
+	int rep = re->byterep[c];
+	re->markgen++;
+	re->set[0] = 0;
+	for (int i = 1; i <= from[0]; i++){
+		struct regexNode* node = &re->nodes[from[i]];
+		if (node->op == RE_CLASS && regexClassHas(re->classes[node->cls], rep)) regexClosure(re, node->out, 0, 0, re->set);
+	}
+	if (d->unanchored) regexClosure(re, re->startnode, 0, 0, re->set);
+	int flushes = d->flushes;
+	next = regexDFAState(re, d, re->set);
+	// after a flush k is gone, the transition is found again next time
+	if (flushes == d->flushes) d->next[k * re->nbytecls + c] = next;
+	return next;
+}
+
+void regexFree(struct regex* re){
+	if (re == NULL) return;
+	struct regexDFA* dfas[3] = {&re->search, &re->anchored, &re->live};
+	for (int j = 0; j < 3; j++){
+		struct regexDFA* d = dfas[j];
+		for (int k = 0; k < d->nstates; k++) free(d->sets[k]);
+		free(d->sets);
+		free(d->flags);
+		free(d->next);
+		free(d->hash);
+	}
+	free(re->nodes);
+	free(re->classes);
+	free(re->startcls[0]);
+	free(re->startcls[1]);
+	free(re->liveat);
+	free(re->alive);
+	free(re->mark);
+	free(re->member);
+	free(re->stack);
+	free(re->set);
+	free(re->eolset);
+	free(re);
+}
+
+// Compiles pattern. Returns NULL and points *err at the reason if it doesn't parse.
+struct regex* regexCompile(const char* pattern, const char** err){
+	struct regex* re = xcalloc(1, sizeof(struct regex));
+	struct regexParser ps = {re, pattern, NULL, 0, 1};
+	struct regexFrag f = regexParseAlt(&ps);
+	if (!ps.err && *ps.p) ps.err = "unmatched )";
+	if (ps.err){
+		*err = ps.err;
+		regexFree(re);
+		return NULL;
+	}
+	re->matchnode = regexNode(re, RE_MATCH, -1, -1);
+	re->nodes[f.end].out = re->matchnode;
+	re->startnode = f.start;
+
+	// bytes that are in the same classes behave the same everywhere in the pattern
+	for (int b = 0; b < 256; b++){
+		int c = 0;
+		for (; c < re->nbytecls; c++){
+			int same = 1;
+			for (int k = 0; k < re->nclasses && same; k++){
+				same = regexClassHas(re->classes[k], b) == regexClassHas(re->classes[k], re->byterep[c]);
+			}
+			if (same) break;
+		}
+		if (c == re->nbytecls) re->byterep[re->nbytecls++] = b;
+		re->bytecls[b] = c;
+	}
+
+	re->mark = xcalloc(re->nnodes, sizeof(int));
+	re->member = xcalloc(re->nnodes, sizeof(int));
+	re->stack = xmalloc(sizeof(int) * (2 * re->nnodes + 1));
+	re->set = xmalloc(sizeof(int) * (re->nnodes + 1));
+	re->eolset = xmalloc(sizeof(int) * (re->nnodes + 1));
+	re->alive = xcalloc(REGEX_ALIVE_MEMO, sizeof(unsigned int));
+	regexDFAInit(&re->search, re->nbytecls, 1);
+	regexDFAInit(&re->anchored, re->nbytecls, 0);
+	regexDFAInit(&re->live, re->nbytecls, 0);
+	re->rowtext = NULL;
+	// the states a match can start in, at the start of the row or later
+	for (int bol = 0; bol < 2; bol++){
+		re->markgen++;
+		re->set[0] = 0;
+		regexClosure(re, re->startnode, bol, 0, re->set);
+		int* cls = re->startcls[bol] = xmalloc(sizeof(int) * (re->set[0] + 1));
+		cls[0] = 0;
+		for (int i = 1; i <= re->set[0]; i++){
+			struct regexNode* node = &re->nodes[re->set[i]];
+			if (node->op != RE_CLASS) continue;
+			cls[++cls[0]] = re->set[i];
+			for (int k = 0; k < 8; k++) re->first[k] |= re->classes[node->cls][k];
+		}
+	}
+	for (int bol = 0; bol < 2; bol++){
+		int k = regexStart(re, &re->anchored, bol);
+		if (re->anchored.flags[k] & (REGEX_ACCEPT | REGEX_ACCEPT_EOL)) re->nullable = 1;
+	}
+	return re;
+}
+
+// Where the first match at or after from ends, -1 if there is none. Only for patterns
+// that can't match the empty string.
+int regexEarliest(struct regex* re, const char* s, int len, int from){
+	struct regexDFA* d = &re->search;
+	regexStart(re, d, 0);
+	int k = regexStart(re, d, from == 0);
+	for (int i = from; i < len; i++){
+		if (d->flags[k] & REGEX_ACCEPT) return i;
+		if (k == d->start[0]){
+			// nothing is under way, a match can only start where the prefix shows up next,
+			// or at least at a byte that can start one
+			if (re->prefixlen){
+				const char* p = editorMemmem(s + i, len - i, re->prefix, re->prefixlen);
+				if (p == NULL) return -1;
+				i = p - s;
+			}
+			while (i < len && !regexClassHas(re->first, (unsigned char)s[i])) i++;
+			if (i == len) break;
+		}
+		unsigned char b = s[i];
+		int next = d->next[k * re->nbytecls + re->bytecls[b]];
+		k = next >= 0 ? next : regexStep(re, d, k, b);
+		if (d->flags[k] & REGEX_DEAD) return -1;
+	}
+	return d->flags[k] & (REGEX_ACCEPT | REGEX_ACCEPT_EOL) ? len : -1;
+}
+
+// marks the nodes of set for regexHas
+void regexMark(struct regex* re, const int* set){
+	re->membergen++;
+	for (int i = 1; i <= set[0]; i++) re->member[set[i]] = re->membergen;
+}
+
+// whether set has a node marked by regexMark
+int regexHas(struct regex* re, const int* set){
+	for (int i = 1; i <= set[0]; i++){
+		if (re->member[set[i]] == re->membergen) return 1;
+	}
+	return 0;
+}
+
+// Looks up the live state for set and works out whether a match starts there
+int regexLiveState(struct regex* re, int* set){
+	struct regexDFA* d = &re->live;
+	int k = regexDFAState(re, d, set);
+	regexMark(re, d->sets[k]);
+	if (regexHas(re, re->startcls[0])) d->flags[k] |= REGEX_START;
+	if (regexHas(re, re->startcls[1])) d->flags[k] |= REGEX_START_BOL;
+	return k;
+}
+
+// The live state at the end of the row: a match can end there, and so can one whose
+// EOL is still to pass
+int regexLiveEnd(struct regex* re){
+	struct regexDFA* d = &re->live;
+	if (d->start[0] < 0){
+		int* set = re->set;
+		set[0] = 0;
+		set[++set[0]] = re->matchnode;
+		for (int n = 0; n < re->nnodes; n++){
+			if (re->nodes[n].op != RE_EOL) continue;
+			re->markgen++;
+			re->eolset[0] = 0;
+			regexClosure(re, re->nodes[n].out, 0, 1, re->eolset);
+			regexMark(re, re->eolset);
+			if (re->member[re->matchnode] == re->membergen) set[++set[0]] = n;
+		}
+		d->start[0] = regexLiveState(re, set);
+	}
+	return d->start[0];
+}
+
+// The live state before byte b when k is the one after it: the nodes that take b and
+// go on to a node of k, with the match node, which is live everywhere
+int regexLiveStep(struct regex* re, int k, unsigned char b){
+	struct regexDFA* d = &re->live;
+	int c = re->bytecls[b];
+	int next = d->next[k * re->nbytecls + c];
+	if (next >= 0) return next;
+
+	int rep = re->byterep[c];
+	int* set = re->set;
+	set[0] = 0;
+	set[++set[0]] = re->matchnode;
+	regexMark(re, d->sets[k]);
+	for (int n = 0; n < re->nnodes; n++){
+		struct regexNode* node = &re->nodes[n];
+		if (node->op != RE_CLASS || !regexClassHas(re->classes[node->cls], rep)) continue;
+		re->markgen++;
+		re->eolset[0] = 0;
+		regexClosure(re, node->out, 0, 0, re->eolset);
+		if (regexHas(re, re->eolset)) set[++set[0]] = n;
+	}
+	int flushes = d->flushes;
+	next = regexLiveState(re, set);
+	if (flushes == d->flushes) d->next[k * re->nbytecls + c] = next;
+	return next;
+}
+
+// One pass backward over s[from..len) that keeps the live state of each position in
+// liveat: the nodes from which the rest of the row still leads to a match, and whether
+// a match starts there.
+void regexLive(struct regex* re, const char* s, int len, int from){
+	struct regexDFA* d = &re->live;
+	if (len + 1 > re->capliveat){
+		re->capliveat = (len + 1) * 2;
+		free(re->liveat);
+		re->liveat = xmalloc(sizeof(unsigned short) * re->capliveat);
+	}
+	int k = regexLiveEnd(re);
+	int flushes = d->flushes;
+	re->liveat[len] = k;
+	re->livetop = len;
+	for (int i = len - 1; i >= from; i--){
+		unsigned char b = s[i];
+		int next = d->next[k * re->nbytecls + re->bytecls[b]];
+		k = next >= 0 ? next : regexLiveStep(re, k, b);
+		if (d->flushes != flushes){
+			// states already stored are gone, those positions can't use them anymore
+			flushes = d->flushes;
+			re->livetop = i;
+		}
+		int start = d->flags[k] & (i == 0 ? REGEX_START_BOL : REGEX_START);
+		re->liveat[i] = k | (start ? REGEX_LIVE_START : 0);
+	}
+	re->rowlive = 1;
+	re->livefrom = from;
+}
+
+// Whether anchored state k still has a node that live state l says leads to a match.
+// Asked for every byte of every match, so the answers are kept.
+int regexAlive(struct regex* re, int k, int l){
+	if (re->aliveflushes[0] != re->anchored.flushes || re->aliveflushes[1] != re->live.flushes){
+		memset(re->alive, 0, sizeof(unsigned int) * REGEX_ALIVE_MEMO);
+		re->aliveflushes[0] = re->anchored.flushes;
+		re->aliveflushes[1] = re->live.flushes;
+	}
+	unsigned int key = (unsigned int)k * WYNAUT_REGEX_STATES + l;
+	unsigned int* slot = &re->alive[(key * 2654435761u >> 20) & (REGEX_ALIVE_MEMO - 1)];
+	if (*slot >> 1 == key + 1) return *slot & 1;
+
+	regexMark(re, re->live.sets[l]);
+	int alive = 0;
+	int* set = re->anchored.sets[k];
+	for (int i = 1; i <= set[0] && !alive; i++){
+		alive = re->nodes[set[i]].op == RE_CLASS && re->member[set[i]] == re->membergen;
+	}
+	*slot = (key + 1) << 1 | alive;
+	return alive;
+}
+
+// End of the longest non-empty match starting at `at`, -1 if none does. Once the row
+// has its live states the scan stops as soon as no longer match is possible, so it reads
+// no further than the match reaches. Before that it reads until the DFA dies, and gives
+// up with -2 when that would take it past the row's budget.
+int regexLongest(struct regex* re, const char* s, int len, int at){
+	struct regexDFA* d = &re->anchored;
+	int k = regexStart(re, d, at == 0);
+	int end = -1;
+	int stop = len;
+	if (!re->rowlive && len - at > re->rowbudget) stop = at + re->rowbudget;
+	int i = at;
+	for (; i < stop; i++){
+		if (re->rowlive && i <= re->livetop && !regexAlive(re, k, re->liveat[i] & ~REGEX_LIVE_START)) return end;
+		unsigned char b = s[i];
+		int next = d->next[k * re->nbytecls + re->bytecls[b]];
+		k = next >= 0 ? next : regexStep(re, d, k, b);
+		if (d->flags[k] & REGEX_DEAD) break;
+		if (d->flags[k] & REGEX_ACCEPT) end = i + 1;
+	}
+	if (!re->rowlive){
+		re->rowbudget -= i - at;
+		if (i == stop && stop < len) return -2;
+	}
+	if (i == len && (d->flags[k] & REGEX_ACCEPT_EOL) && len > at) end = len;
+	return end;
+}
+
+// Finds the leftmost-longest match at or after from. Returns where it starts and sets
+// *mlen, or returns -1. The search DFA tells where the first match ends, which rules
+// out most rows in one pass. The match starts at or before that end, the first position
+// from which the anchored DFA gets a match is its start.
+//
+// Trying every position can read the rest of the row for each of them, so the anchored
+// DFA gets a budget of a few times the row's length. A row that uses it up gets a pass
+// backward that marks where matches start and which nodes can still lead to one at each
+// position, after that only real starts are tried and each reads no further than its
+// match. Either way finding all the matches of a row takes time linear in its length.
+// Calls for one row have to go left to right starting with from 0, that is when the
+// budget is set.
+int regexFind(struct regex* re, const char* s, int len, int from, int* mlen){
+	if (from == 0 || s != re->rowtext || len != re->rowlen || (re->rowlive && from < re->livefrom)){
+		re->rowtext = s;
+		re->rowlen = len;
+		re->rowbudget = 2 * len + 256;
+		re->rowlive = 0;
+	}
+	int last = len - 1;
+	if (!re->nullable){
+		int end = regexEarliest(re, s, len, from);
+		if (end < 0) return -1;
+		last = end - 1;
+	}
+	for (int i = from; i <= last; i++){
+		if (re->rowlive){
+			if (!(re->liveat[i] & REGEX_LIVE_START)) continue;
+		}
+		else{
+			if (re->prefixlen){
+				const char* p = editorMemmem(s + i, len - i, re->prefix, re->prefixlen);
+				if (p == NULL) return -1;
+				i = p - s;
+				if (i > last) return -1;
+			}
+			if (!regexClassHas(re->first, (unsigned char)s[i])) continue;
+		}
+		int end = regexLongest(re, s, len, i);
+		if (end == -2){
+			// over budget, the positions before i have been ruled out already
+			regexLive(re, s, len, i);
+			if (!(re->liveat[i] & REGEX_LIVE_START)) continue;
+			end = regexLongest(re, s, len, i);
+		}
+		if (end > i){
+			*mlen = end - i;
+			return i;
+		}
+	}
+	return -1;
+}
+
+/** find **/
+
+// Rows matching the query typed in the find prompt. They are kept while the prompt
+// is open, so when the query grows only the rows that matched before get rechecked.
+struct editorSearch {
+	char* query;
+	int qlen;
+	int regex; // the query is a pattern
+	struct regex* re; // compiled from it, NULL if it doesn't parse
+	const char* err; // why it doesn't
+	int* rows; // rows with at least one match, ascending
+	int nrows, caprows;
+	long long total; // matches over all those rows
+	int* cand; // rows that matched the previous query and still have to be rechecked
+	int ncand, candpos;
+	int scanpos; // rows from here on haven't been looked at at all
+	int jump; // move to the first match as soon as one turns up
+};
+
+// Finds needle in hay. With SSE2 it compares the needle's first and last byte against
+// 16 positions at once and only runs memcmp where both agree.
+const char* editorMemmem(const char* hay, int n, const char* needle, int m){
+	if (m == 0) return hay;
+	if (m > n) return NULL;
+	if (m == 1) return memchr(hay, needle[0], n);
+	int i = 0;
+#ifdef __SSE2__
+	__m128i first = _mm_set1_epi8(needle[0]);
+	__m128i last = _mm_set1_epi8(needle[m - 1]);
+	for (; i + 16 + m - 1 <= n; i += 16){
+		__m128i a = _mm_loadu_si128((const __m128i*)(hay + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(hay + i + m - 1));
+		unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+		while (mask){
+			int bit = __builtin_ctz(mask);
+			if (!memcmp(hay + i + bit + 1, needle + 1, m - 2)) return hay + i + bit;
+			mask &= mask - 1;
+		}
+	}
+#endif
+	for (; i + m <= n; i++){
+		const char* p = memchr(hay + i, needle[0], n - m + 1 - i);
+		if (p == NULL) return NULL;
+		i = p - hay;
+		if (!memcmp(p + 1, needle + 1, m - 1)) return p;
+	}
+	return NULL;
+}
+
+// First match in text at or after from. Returns where it starts and sets *mlen, or -1.
+int editorSearchMatch(struct editorSearch* s, const char* text, int len, int from, int* mlen){
+	if (s->re) return regexFind(s->re, text, len, from, mlen);
+	const char* p = editorMemmem(text + from, len - from, s->query, s->qlen);
+	*mlen = s->qlen;
+	return p ? p - text : -1;
+}
+
+// counts the non-overlapping matches in text
+int editorCountMatches(struct editorSearch* s, const char* text, int len){
+	int count = 0;
+	int at = 0, mlen;
+	while ((at = editorSearchMatch(s, text, len, at, &mlen)) >= 0){
+		count++;
+		at += mlen;
+	}
+	return count;
+}
+
+void editorSearchFree(struct editorSearch* s){
+	if (s == NULL) return;
+	free(s->query);
+	regexFree(s->re);
+	free(s->rows);
+	free(s->cand);
+	free(s);
+}
+
+// Starts searching for query, a pattern if regex is set. If a plain query contains the
+// previous one, only rows that matched (or were still waiting to be checked) can match
+// and the scan narrows. Patterns don't narrow like that, "a|b" contains "a".
+void editorSearchSetQuery(char* query, int regex){
+	struct editorSearch* old = E.search;
+	struct editorSearch* s = xcalloc(1, sizeof(struct editorSearch));
+	s->query = xstrdup(query);
+	s->qlen = strlen(query);
+	s->jump = 1;
+	s->regex = regex;
+	if (regex && s->qlen) s->re = regexCompile(query, &s->err);
+
+	if (!regex && old && !old->regex && old->qlen && strstr(query, old->query)){
+		// merge the confirmed rows with the ones not rechecked yet, both are ascending
+		int left = old->ncand - old->candpos;
+		s->cand = xmalloc(sizeof(int) * (old->nrows + left + 1));
+		int a = 0, b = old->candpos;
+		while (a < old->nrows || b < old->ncand){
+			if (b >= old->ncand || (a < old->nrows && old->rows[a] < old->cand[b])) s->cand[s->ncand++] = old->rows[a++];
+			else s->cand[s->ncand++] = old->cand[b++];
+		}
+		s->scanpos = old->scanpos;
+	}
+	editorSearchFree(old);
+	E.search = s;
+}
+
+void editorSearchAddRow(struct editorSearch* s, int at, int count){
+	if (s->nrows == s->caprows){
+		s->caprows = s->caprows ? s->caprows * 2 : 64;
+		s->rows = xrealloc(s->rows, sizeof(int) * s->caprows);
+	}
+	s->rows[s->nrows++] = at;
+	s->total += count;
+}
+
+int editorSearchDone(struct editorSearch* s){
+	return s->candpos >= s->ncand && s->scanpos >= E.numrows;
+}
+
+// Scans for matches for at most budget microseconds. Returns 1 while rows are left.
+int editorSearchStep(struct editorSearch* s, long long budget){
+	long long deadline = editorMicros() + budget;
+	if (s->qlen == 0 || s->err){
+		s->candpos = s->ncand;
+		s->scanpos = E.numrows;
+		return 0;
+	}
+
+	// rows are read where they are, chunks that are paged out stay out
+	int n = 0;
+	struct lineiter it;
+	const char* chars;
+	int len;
+	if (s->candpos < s->ncand){
+		editorLineIterInit(&it, s->cand[s->candpos]);
+		while (s->candpos < s->ncand){
+			int at = s->cand[s->candpos++];
+			editorLineIterSkip(&it, at);
+			editorLineIterNext(&it, &chars, &len);
+			int count = editorCountMatches(s, chars, len);
+			if (count) editorSearchAddRow(s, at, count);
+			if (++n % 256 == 0 && editorMicros() > deadline) break;
+		}
+		editorLineIterFree(&it);
+		if (s->candpos < s->ncand) return 1;
+	}
+
+	editorLineIterInit(&it, s->scanpos);
+	while (editorLineIterNext(&it, &chars, &len)){
+		int count = editorCountMatches(s, chars, len);
+		if (count) editorSearchAddRow(s, s->scanpos, count);
+		s->scanpos++;
+		if (++n % 256 == 0 && editorMicros() > deadline) break;
+	}
+	editorLineIterFree(&it);
+	return !editorSearchDone(s);
+}
+
+// puts the cursor on the first match in row `at`, scrolled to the top of the screen
+void editorSearchGoto(int at){
+	erow* row = editorRowAt(at);
+	int mlen;
+	int match = editorSearchMatch(E.search, row->chars, row->size, 0, &mlen);
+	E.cy = at;
+	E.cx = match >= 0 ? match : 0;
+	E.rowoff = E.numrows;
+}
+
+// Returns the first matching row after (direction 1) or before (-1) row `from`,
+// wrapping around the file. Scans further if the answer isn't known yet.
+int editorSearchNext(int from, int direction){
+	struct editorSearch* s = E.search;
+	while (1){
+		// rows is sorted, find the first entry past `from`
+		int lo = 0, hi = s->nrows;
+		while (lo < hi){
+			int mid = (lo + hi) / 2;
+			if (s->rows[mid] <= from) lo = mid + 1;
+			else hi = mid;
+		}
+		if (direction == 1 && lo < s->nrows) return s->rows[lo];
+		if (direction == -1 && lo > 0 && s->rows[lo - 1] == from) lo--;
+		if (direction == -1 && lo > 0) return s->rows[lo - 1];
+		if (editorSearchDone(s)) break;
+		editorSearchStep(s, WYNAUT_SLICE_US);
+	}
+	if (s->nrows == 0) return -1;
+	return direction == 1 ? s->rows[0] : s->rows[s->nrows - 1];
+}
+
+// background part of the search, runs while the prompt waits for keys
+int editorSearchIdle(){
+	struct editorSearch* s = E.search;
+	if (s == NULL || editorSearchDone(s)) return 0;
+	int more = editorSearchStep(s, WYNAUT_SLICE_US);
+	if (s->jump && s->nrows){
+		s->jump = 0;
+		editorSearchGoto(s->rows[0]);
+	}
+	return more;
+}
+
+// Overlays HL_MATCH on the visible part of a row's highlight. Returns hl itself when the
+// row has no match, or a copy with the matches marked.
+unsigned char* editorSearchHighlight(erow* row, int coloff, int len, unsigned char* hl){
+	static unsigned char* buf = NULL;
+	static int buflen = 0;
+	struct editorSearch* s = E.search;
+	if (s == NULL || s->qlen == 0 || s->err || len <= 0) return hl;
+
+	// only the chars behind the visible columns can match, long rows stay cheap. A
+	// pattern match can be any length, so those are looked for from the start of the row.
+	int lo = 0, hi = row->size;
+	if (s->re == NULL){
+		lo = editorRowRxToCx(row, coloff);
+		hi = editorRowRxToCx(row, coloff + len) + s->qlen;
+		lo = lo > s->qlen ? lo - s->qlen : 0;
+		if (hi > row->size) hi = row->size;
+	}
+	int at = lo, mlen;
+	int copied = 0;
+	while ((at = editorSearchMatch(s, row->chars, hi, at, &mlen)) >= 0){
+		int from = editorRowCxToRx(row, at) - coloff;
+		int to = editorRowCxToRx(row, at + mlen) - coloff;
+		at += mlen;
+		if (to <= 0) continue;
+		if (from >= len) break;
+		if (!copied){
+			if (len > buflen){
+				buflen = len;
+				buf = xrealloc(buf, buflen);
+			}
+			memcpy(buf, hl, len);
+			copied = 1;
+		}
+		if (from < 0) from = 0;
+		if (to > len) to = len;
+		memset(&buf[from], HL_MATCH, to - from);
+	}
+	return copied ? buf : hl;
+}
+
+// whether the find prompt takes patterns, Ctrl-E flips it and it stays for the next search
+int find_regex = 0;
+
+void editorFindCallback(char* query, int key){
+	static int last_match = -1;
+
+	if(key == '\r' || key == '\x1b'){
+		last_match = -1;
+		editorSearchFree(E.search);
+		E.search = NULL;
+		return;
+	}
+
+	if (key == ARROW_RIGHT || key == ARROW_DOWN || key == ARROW_LEFT || key == ARROW_UP){
+		if (E.search == NULL) return;
+		int direction = (key == ARROW_RIGHT || key == ARROW_DOWN) ? 1 : -1;
+		int next = editorSearchNext(last_match == -1 ? E.cy : last_match, direction);
+		if (next != -1){
+			last_match = next;
+			editorSearchGoto(next);
+		}
+		return;
+	}
+
+	if (key == CTRL_KEYS('e')) find_regex = !find_regex;
+	else if (E.search && !strcmp(E.search->query, query)) return;
+
+	// the query changed: look again from the top of the file
+	last_match = -1;
+	editorSearchSetQuery(query, find_regex);
+	editorSearchStep(E.search, WYNAUT_SLICE_US);
+	if (E.search->nrows){
+		E.search->jump = 0;
+		last_match = E.search->rows[0];
+		editorSearchGoto(last_match);
+	}
+}
+
+// Implements the search function, asks for a query and returns first instance of it in file
+void editorFind(){
+	// Saving current cursor position incase user cancels search
+	int saved_cx = E.cx;
+	int saved_cy = E.cy;
+	int saved_coloff = E.coloff;
+	int saved_rowoff = E.rowoff;
+
+	char* query = editorPrompt("Search: %s (Use ESC/Arrows/Enter, Ctrl-E = regex)", editorFindCallback);
+	
+	if (query){
+		free(query);
+	}
+	else{
+		E.cx = saved_cx;
+		E.cy = saved_cy;
+		E.coloff = saved_coloff;
+		E.rowoff = saved_rowoff;
+	}
+}
+
+
+/** replace **/
+
+// a row replace all rewrites: the span from its first match to the end of its last
+struct replaceRow {
+	int row;
+	int at, len;
+	long long off; // where the new span starts in the slice's text
+	int newlen;
+};
+
+// Rows one replace all thread rebuilds. The new spans go one after the other in text
+// and are put in place by the main thread once all threads are done.
+struct replaceSlice {
+	pthread_t thread;
+	int threaded;
+	struct editorSearch match; // a copy per thread, a regex's DFA cache can't be shared
+	const char* with;
+	int wlen;
+	int lo, hi; // rows
+	struct replaceRow* rows;
+	int n, cap;
+	char* text;
+	long long used, textcap;
+	long long count; // matches replaced
+};
+
+void editorReplaceAppend(struct replaceSlice* s, const char* p, int len){
+	// text is still NULL before the first append
+	if (len == 0) return;
+	if (s->used + len > s->textcap){
+		s->textcap = (s->used + len) * 2;
+		s->text = xrealloc(s->text, s->textcap);
+	}
+	memcpy(s->text + s->used, p, len);
+	s->used += len;
+}
+
+// Rebuilds the rows of a slice that have a match. They are read where they are, so
+// nothing gets paged in or out while the threads run.
+void* editorReplaceWorker(void* arg){
+	struct replaceSlice* s = arg;
+	s->n = 0;
+	s->used = 0;
+	struct lineiter it;
+	const char* chars;
+	int len;
+	editorLineIterInit(&it, s->lo);
+	for (int r = s->lo; r < s->hi && editorLineIterNext(&it, &chars, &len); r++){
+		int mlen;
+		int at = editorSearchMatch(&s->match, chars, len, 0, &mlen);
+		if (at < 0) continue;
+		if (s->n == s->cap){
+			s->cap = s->cap ? s->cap * 2 : 256;
+			s->rows = xrealloc(s->rows, sizeof(struct replaceRow) * s->cap);
+		}
+		struct replaceRow* rr = &s->rows[s->n++];
+		rr->row = r;
+		rr->at = at;
+		rr->off = s->used;
+		int from = at;
+		while (at >= 0){
+			editorReplaceAppend(s, chars + from, at - from);
+			editorReplaceAppend(s, s->with, s->wlen);
+			s->count++;
+			from = at + mlen;
+			at = editorSearchMatch(&s->match, chars, len, from, &mlen);
+		}
+		rr->len = from - rr->at;
+		rr->newlen = s->used - rr->off;
+	}
+	editorLineIterFree(&it);
+	return NULL;
+}
+
+// Replaces every match of query, a pattern if regex is set, with `with`. Rows are
+// taken WYNAUT_REPLACE_BATCH per thread at a time: the threads find the matches and
+// build the new text of the rows that have one, then each of those rows is rewritten
+// once. The whole replace is one undo step, unless it wouldn't fit in half the undo
+// budget, then history is dropped instead. Returns the number of matches replaced.
+long long editorReplaceAll(const char* query, int regex, const char* with, int* nrows, int* undoable){
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int n = cpus < 1 ? 1 : cpus > WYNAUT_REPLACE_THREADS ? WYNAUT_REPLACE_THREADS : cpus;
+	struct replaceSlice s[WYNAUT_REPLACE_THREADS];
+	memset(s, 0, sizeof(s));
+	for (int i = 0; i < n; i++){
+		s[i].match.query = (char*)query;
+		s[i].match.qlen = strlen(query);
+		s[i].match.regex = regex;
+		if (regex) s[i].match.re = regexCompile(query, &s[i].match.err);
+		s[i].with = with;
+		s[i].wlen = strlen(with);
+	}
 
-	int idx = 0;
-	for (int j =0; j<row->size;j++){
-		if(row->chars[j] == '\t'){
-			row->render[idx++] = ' ';
-			while (idx % WYNAUT_TAB_STOP != 0) row->render[idx++] = ' ';
+	editorUndoBreak();
+	long long count = 0;
+	long long undo = 0;
+	*nrows = 0;
+	*undoable = 1;
+	int paused = E.undo.paused;
+	for (int lo = 0; lo < E.numrows; lo += n * WYNAUT_REPLACE_BATCH){
+		for (int i = 0; i < n; i++){
+			s[i].lo = lo + i * WYNAUT_REPLACE_BATCH;
+			s[i].hi = s[i].lo + WYNAUT_REPLACE_BATCH;
+			if (s[i].lo > E.numrows) s[i].lo = E.numrows;
+			if (s[i].hi > E.numrows) s[i].hi = E.numrows;
 		}
-		else{
-			row->render[idx++] = row->chars[j];
+		for (int i = 1; i < n; i++){
+			s[i].threaded = pthread_create(&s[i].thread, NULL, editorReplaceWorker, &s[i]) == 0;
+		}
+		editorReplaceWorker(&s[0]);
+		for (int i = 1; i < n; i++){
+			if (s[i].threaded) pthread_join(s[i].thread, NULL);
+			else editorReplaceWorker(&s[i]);
+		}
+
+		for (int i = 0; i < n; i++){
+			for (int j = 0; j < s[i].n; j++){
+				struct replaceRow* rr = &s[i].rows[j];
+				undo += undoOpSize(rr->len) + undoOpSize(rr->newlen);
+				if (*undoable && undo > E.undo.budget / 2){
+					// one step that big would be cut up when the log is trimmed
+					editorUndoReset();
+					editorUndoForget(-1);
+					E.undo.paused = 1;
+					*undoable = 0;
+				}
+				editorRowReplace(rr->row, rr->at, rr->len, s[i].text + rr->off, rr->newlen);
+			}
+			*nrows += s[i].n;
+			count += s[i].count;
+			s[i].count = 0;
 		}
+		// the rows just rewritten may have paged chunks in
+		editorPageTrim();
 	}
-	row->render[idx] = '\0';
-	row->rsize = idx;
+	E.undo.paused = paused;
+	editorUndoBreak();
 
-	editorUpdateSyntax(row);
+	for (int i = 0; i < n; i++){
+		regexFree(s[i].match.re);
+		free(s[i].rows);
+		free(s[i].text);
+	}
+	return count;
 }
 
-void editorInsertRow(int at,char* s, size_t len){
-	if (at < 0 || at > E.numrows) return;
-
-	E.row = realloc(E.row, sizeof(erow)*(E.numrows+1));
-	memmove(&E.row[at + 1], &E.row[at], sizeof(erow)*(E.numrows-at));
+// Asks for what to replace, through the find prompt so matches show up while typing,
+// and what to replace it with
+void editorReplace(){
+	int saved_cx = E.cx;
+	int saved_cy = E.cy;
+	int saved_coloff = E.coloff;
+	int saved_rowoff = E.rowoff;
 
+	char* query = editorPrompt("Replace: %s (Use ESC/Arrows/Enter, Ctrl-E = regex)", editorFindCallback);
+	const char* err = NULL;
+	if (query && find_regex) regexFree(regexCompile(query, &err));
+	if (err) editorSetStatusMessage("regex: %s", err);
+	// the find callback moved the cursor to the matches, it goes back unless they are replaced
+	char* with = query && !err ? editorPromptRead("Replace with: %s (ESC to cancel)", NULL, 1) : NULL;
+	if (with == NULL){
+		free(query);
+		E.cx = saved_cx;
+		E.cy = saved_cy;
+		E.coloff = saved_coloff;
+		E.rowoff = saved_rowoff;
+		return;
+	}
 
-	E.row[at].size = len;
-	E.row[at].chars = malloc(len+1);
-	memcpy(E.row[at].chars,s,len);
-	E.row[at].chars[len] = '\0';
+	long long start = editorMicros();
+	int nrows, undoable;
+	long long count = editorReplaceAll(query, find_regex, with, &nrows, &undoable);
+	if (E.cy < E.numrows && E.cx > editorRowAt(E.cy)->size) E.cx = editorRowAt(E.cy)->size;
+	editorSetStatusMessage("Replaced %lld matches in %d lines in %.2fs%s", count, nrows,
+		(editorMicros() - start) / 1e6, undoable ? "" : " (too large to undo)");
+	free(query);
+	free(with);
+}
 
-	E.row[at].rsize = 0;
-	E.row[at].render = NULL;
-	E.row[at].hl = NULL;
-	editorUpdateRow(&E.row[at]);
+/** fuzzy find **/
 
-	E.numrows++;
-	E.dirty++;
-}
+#define FUZZY_NOMATCH INT_MIN
+#define FUZZY_MAXLEN 4096 // longer lines are only scored on their first FUZZY_MAXLEN bytes
+#define FUZZY_SCORE_MATCH 16
+#define FUZZY_BONUS_BOUNDARY 10 // match at the start of a word
+#define FUZZY_BONUS_CAMEL 8 // match on a lower to upper case change
+#define FUZZY_BONUS_CONSECUTIVE 12 // match right after the previous one
+#define FUZZY_GAP_OPEN 6
+#define FUZZY_GAP_EXTEND 1
 
-// frees from memory a given row and the chars in it
-void editorFreeRow(erow* row){
-	free(row->render);
-	free(row->chars);
-	free(row->hl);
-}
+struct fuzzyHit {
+	int score;
+	int line;
+};
 
-// handles deleting a char if it happens to be the start of the row
-void editorDelRow(int at){
-	if (at < 0 || at >= E.numrows) return;
-	editorFreeRow(&E.row[at]);
-	memmove(&E.row[at],&E.row[at+1],sizeof(erow)*(E.numrows-at-1));
-	E.numrows--;
-	E.dirty++;
-}
+// Fuzzy find scores every row on worker threads. Workers grab chunks of rows, keep
+// their own best hits and merge them into `top` after each chunk, so results show
+// up while the rest of the file is still being scored.
+struct editorFuzzy {
+	char* typed; // query as typed
+	char* query; // folded unless smartcase
+	int qlen;
+	int smartcase; // query has upper case letters, so matching is case sensitive
+	rowchunk* chunks; // copy of every chunk in order, rows don't change while the prompt is open
+	int* chunkline; // first row of each chunk
+	int nchunks;
+	pthread_t threads[WYNAUT_FUZZY_THREADS];
+	int nthreads;
+
+	pthread_mutex_t lock; // guards everything below
+	int next; // next chunk to hand out
+	int cancel;
+	int running; // workers that haven't finished
+	int scanned; // rows scored so far
+	struct fuzzyHit top[WYNAUT_FUZZY_TOP];
+	int ntop;
+	int version; // bumped whenever top changes
+
+	int shown; // version on screen
+	int selected; // highlighted entry of top
+};
 
-// deletes characters given position
-void editorRowDelChar(erow* row, int at){
-	if(at<0 || at >= row->size) return;
-	// move all characters that come after the character one step back
-	memmove(&row->chars[at],&row->chars[at+1],row->size - at);
-	row->size--;
-	editorUpdateRow(row);
-	E.dirty++;
+int fuzzyFold(int c, int smartcase){
+	return smartcase ? c : tolower(c);
 }
 
-// Deals with how to modify a row and adds a char in a specific place
-void editorRowInsertChar(erow* row, int at, int c){
-	// checks if input point is in bounds
-	if (at < 0 || at > row->size) at = row->size;
-	// we add 2 bytes as 1 for the character and one for the null character
-	// but does there not already exist a null char?
-	row->chars = realloc(row->chars,row->size + 2);
-	// All the characters from 'at' onwards are moved one step ahead to
-	// make space for the inserted character
-	memmove(&row->chars[at+1], &row->chars[at], row->size - at +1);
-	row->size++;
-	row->chars[at] = c;
-	editorUpdateRow(row);
-	E.dirty++;
-}
+// Scores text against the query with a Smith-Waterman style alignment where every
+// query char has to match, in order. Matches at word starts or right after the previous
+// match earn bonuses, gaps between matches cost a little per skipped byte.
+// Returns FUZZY_NOMATCH when the query isn't a subsequence of the text.
+int editorFuzzyScore(const char* text, int n, const char* q, int m, int smartcase, int* buf){
+	if (n > FUZZY_MAXLEN) n = FUZZY_MAXLEN;
+	if (m > 64) m = 64;
+	if (m == 0) return 0;
+	if (m > n) return FUZZY_NOMATCH;
+
+	// earliest and latest position each query char can take, bounds the dp below
+	int first[64], last[64];
+	int j = 0;
+	for (int i = 0; i < m; i++){
+		while (j < n && fuzzyFold((unsigned char)text[j], smartcase) != q[i]) j++;
+		if (j == n) return FUZZY_NOMATCH;
+		first[i] = j++;
+	}
+	j = n - 1;
+	for (int i = m - 1; i >= 0; i--){
+		while (fuzzyFold((unsigned char)text[j], smartcase) != q[i]) j--;
+		last[i] = j--;
+	}
 
-void editorRowAppendString(erow* row, char* s, size_t len){
-	row->chars = realloc(row->chars,row->size +len+1);
-	memcpy(&row->chars[row->size],s,len);
-	row->size += len;
-	row->chars[row->size] = '\0';
-	editorUpdateRow(row);
-	E.dirty++;
-}
+	// prev[j]: best score with query char i-1 matched at text j, cur the same for char i
+	int* prev = buf;
+	int* cur = buf + n;
+	for (int i = 0; i < m; i++){
+		int run = FUZZY_NOMATCH; // best of prev[k] minus the gap cost, over k <= j-2
+		// the sweep starts right after char i-1's earliest spot so run has seen every
+		// prev[k] by the time j reaches first[i], however wide the gap
+		for (j = i > 0 ? first[i-1] + 1 : first[i]; j <= last[i]; j++){
+			if (run != FUZZY_NOMATCH) run -= FUZZY_GAP_EXTEND;
+			if (i > 0 && j - 2 >= first[i-1] && j - 2 <= last[i-1] && prev[j-2] != FUZZY_NOMATCH &&
+					prev[j-2] - FUZZY_GAP_OPEN > run){
+				run = prev[j-2] - FUZZY_GAP_OPEN;
+			}
+			if (j < first[i]) continue;
 
-/** editor operations **/
+			int c = (unsigned char)text[j];
+			if (fuzzyFold(c, smartcase) != q[i]){
+				cur[j] = FUZZY_NOMATCH;
+				continue;
+			}
+			int score = FUZZY_SCORE_MATCH;
+			int pc = j > 0 ? (unsigned char)text[j-1] : ' ';
+			if (!isalnum(pc) && isalnum(c)) score += FUZZY_BONUS_BOUNDARY;
+			else if (islower(pc) && isupper(c)) score += FUZZY_BONUS_CAMEL;
 
-// Deals with where the cursor is and adds a char
-void editorInsertChar(int c){
-	// checks if cursor is at end of line,and then adds a new row
-	if(E.cy == E.numrows) {
-		editorInsertRow(E.numrows, "",0);
+			if (i == 0){
+				cur[j] = score;
+				continue;
+			}
+			int best = run;
+			if (j - 1 >= first[i-1] && j - 1 <= last[i-1] && prev[j-1] != FUZZY_NOMATCH &&
+					prev[j-1] + FUZZY_BONUS_CONSECUTIVE > best){
+				best = prev[j-1] + FUZZY_BONUS_CONSECUTIVE;
+			}
+			cur[j] = best == FUZZY_NOMATCH ? FUZZY_NOMATCH : best + score;
+		}
+		int* t = prev;
+		prev = cur;
+		cur = t;
 	}
-	editorRowInsertChar(&E.row[E.cy],E.cx,c);
-	E.cx++; // move cursor forward
-}
 
-// mapped to return key
-void editorInsertNewline() {
-	if (E.cx == 0){
-		editorInsertRow(E.cy, "", 0);
-	}
-	else{
-		erow* row = &E.row[E.cy];
-		editorInsertRow(E.cy +1, &row->chars[E.cx],row->size - E.cx);
-		row = &E.row[E.cy]; //editorInsertRow calls realloc and might invalidate the pointer
-		row->size = E.cx;
-		row->chars[row->size] = '\0';
-		editorUpdateRow(row);
-	}
-	E.cy++;
-	E.cx = 0;
-}
-// Mapped to Backspace character
-void editorDelChar(){
-	if(E.cy == E.numrows) return;
-	if(E.cx==0 && E.cy == 0)return;
-	erow* row = &E.row[E.cy];
-	if (E.cx >0){
-		editorRowDelChar(row,E.cx-1);
-		E.cx--;
-	}
-	else{ // moves everything to the end of the last line and deletes current row
-		E.cx = E.row[E.cy-1].size;
-		editorRowAppendString(&E.row[E.cy-1],row->chars,row->size);
-		editorDelRow(E.cy);
-		E.cy--;
+	int best = FUZZY_NOMATCH;
+	for (j = first[m-1]; j <= last[m-1]; j++){
+		if (prev[j] > best) best = prev[j];
 	}
+	return best;
 }
 
-/** file i/o **/
+// higher scores first, earlier lines break ties
+int fuzzyBetter(struct fuzzyHit* a, struct fuzzyHit* b){
+	return a->score > b->score || (a->score == b->score && a->line < b->line);
+}
 
-// returns the entire file as a char*
-char* editorRowsToString(int* buflen){
-	int totlen = 0;
-	int j;
-	for (j =0; j < E.numrows; j++){
-		totlen += E.row[j].size +1; // +1 for \n
-	}
-	*buflen = totlen; // num of chars in file
-
-	char* buf = malloc(totlen);
-	char* p = buf;
-	for (j = 0; j<E.numrows; j++){
-		memcpy(p, E.row[j].chars, E.row[j].size);//copies each row to string
-		p += E.row[j].size;
-		*p = '\n';
-		p++;
+// inserts a hit into a sorted top list of at most WYNAUT_FUZZY_TOP entries
+void fuzzyInsert(struct fuzzyHit* top, int* ntop, struct fuzzyHit* h){
+	if (*ntop == WYNAUT_FUZZY_TOP && !fuzzyBetter(h, &top[*ntop - 1])) return;
+	int i = *ntop < WYNAUT_FUZZY_TOP ? (*ntop)++ : *ntop - 1;
+	while (i > 0 && fuzzyBetter(h, &top[i-1])){
+		top[i] = top[i-1];
+		i--;
 	}
-	return buf; // expect caller to free memory
+	top[i] = *h;
 }
 
-// opens a file and loads it into editorConfig
-void editorOpen(char* filename) {
-	free(E.filename);
-	E.filename = strdup(filename); // copies given string and dynamically allocates memory
+void* editorFuzzyWorker(void* arg){
+	struct editorFuzzy* f = arg;
+	int* buf = xmalloc(sizeof(int) * 2 * FUZZY_MAXLEN);
+	struct fuzzyHit local[WYNAUT_FUZZY_TOP];
 
-	editorSelectSyntaxHighlight();
+	while (1){
+		pthread_mutex_lock(&f->lock);
+		if (f->cancel || f->next >= f->nchunks){
+			f->running--;
+			pthread_mutex_unlock(&f->lock);
+			break;
+		}
+		int ci = f->next++;
+		pthread_mutex_unlock(&f->lock);
+
+		rowchunk* c = &f->chunks[ci];
+		// a chunk that is paged out is scored straight from its text
+		char* text = NULL;
+		const char* p = NULL;
+		const char* end = NULL;
+		if (c->rows == NULL && (p = rowChunkText(c, &text))) end = p + c->srclen;
+		int nlocal = 0;
+		for (int i = 0; i < c->n; i++){
+			const char* chars;
+			int len;
+			if (c->rows){
+				chars = c->rows[i].chars;
+				len = c->rows[i].size;
+			}
+			else if (p){
+				chars = p;
+				p = editorNextLine(p, end, &len);
+			}
+			else continue;
+			struct fuzzyHit h;
+			h.score = editorFuzzyScore(chars, len, f->query, f->qlen, f->smartcase, buf);
+			if (h.score == FUZZY_NOMATCH) continue;
+			h.line = f->chunkline[ci] + i;
+			fuzzyInsert(local, &nlocal, &h);
+		}
 
-	FILE* fp = fopen(filename,"r");
-	if (!fp) die("fopen");
+		free(text);
 
-	char* line = NULL;
-	size_t linecap = 0;
-	ssize_t linelen;
-	while ((linelen = getline(&line, &linecap, fp)) != -1){
-		while (linelen>0 && (line[linelen-1] == '\n' || line[linelen-1] == '\r'))
-			linelen--;
-		editorInsertRow(E.numrows, line, linelen);
+		pthread_mutex_lock(&f->lock);
+		for (int i = 0; i < nlocal; i++) fuzzyInsert(f->top, &f->ntop, &local[i]);
+		f->scanned += c->n;
+		f->version++;
+		pthread_mutex_unlock(&f->lock);
 	}
-	free(line);
-	fclose(fp);
-	E.dirty = 0;
+	free(buf);
+	return NULL;
 }
 
-// saves to file
-void editorSave(){
-	if(E.filename == NULL){
-        E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
-        if (E.filename == NULL){
-            editorSetStatusMessage("Save aborted");
-            return;
-        }
-		editorSelectSyntaxHighlight();
-    }
-
-	int len;
-	char* buf = editorRowsToString(&len); //gets the entire file
+// stops the workers and waits for them, they finish at most the chunk they are on
+void editorFuzzyStop(struct editorFuzzy* f){
+	pthread_mutex_lock(&f->lock);
+	f->cancel = 1;
+	pthread_mutex_unlock(&f->lock);
+	for (int i = 0; i < f->nthreads; i++) pthread_join(f->threads[i], NULL);
+	f->nthreads = 0;
+}
 
-	// open creates a new file if it doesnt exist O_CREAT and 
-	//opens it for reading and writing O_RDWR
-	// 0644 is standard permissions
-	int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-	if (fd != -1){
-		if (ftruncate(fd,len)!= -1){// sets file size to specific length
-		// we manually truncate so that in case write fails, we still have some data
-			if (write(fd, buf, len) == len){
-				close(fd);
-				free(buf);
-				E.dirty=0;
-				editorSetStatusMessage("%d bytes written to disk", len);
-				return;
-			}
+// scores the whole buffer against a new query
+void editorFuzzyStart(struct editorFuzzy* f, char* query){
+	editorFuzzyStop(f);
+	free(f->typed);
+	free(f->query);
+	f->typed = xstrdup(query);
+	f->query = xstrdup(query);
+	f->qlen = strlen(query);
+	f->smartcase = 0;
+	for (int i = 0; i < f->qlen; i++){
+		if (isupper((unsigned char)query[i])) f->smartcase = 1;
+	}
+	for (int i = 0; i < f->qlen; i++) f->query[i] = fuzzyFold((unsigned char)query[i], f->smartcase);
+
+	f->next = 0;
+	f->cancel = 0;
+	f->scanned = 0;
+	f->ntop = 0;
+	f->selected = 0;
+	f->version++;
+	if (f->qlen == 0) return;
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int n = cpus < 1 ? 1 : cpus > WYNAUT_FUZZY_THREADS ? WYNAUT_FUZZY_THREADS : cpus;
+	f->running = n;
+	for (int i = 0; i < n; i++){
+		if (pthread_create(&f->threads[f->nthreads], NULL, editorFuzzyWorker, f) != 0){
+			pthread_mutex_lock(&f->lock);
+			f->running -= n - i;
+			pthread_mutex_unlock(&f->lock);
+			break;
 		}
-		close(fd);
+		f->nthreads++;
 	}
-	free(buf);
-	editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
 }
 
-/** find **/
+struct editorFuzzy* editorFuzzyNew(){
+	struct editorFuzzy* f = xcalloc(1, sizeof(struct editorFuzzy));
+	pthread_mutex_init(&f->lock, NULL);
+	int nchunks = E.rows ? E.rows->chunks : 0;
+	f->chunks = xmalloc(sizeof(rowchunk) * (nchunks + 1));
+	f->chunkline = xmalloc(sizeof(int) * (nchunks + 1));
+	int line = 0;
+	for (int i = 0; i < nchunks; i++){
+		// copies, paging a chunk in replaces its node but not the text it points at
+		f->chunks[i] = *rowChunkNth(i);
+		f->chunkline[i] = line;
+		line += f->chunks[i].n;
+	}
+	f->nchunks = nchunks;
+	return f;
+}
 
-void editorFindCallback(char* query, int key){
-	static int last_match = -1;
-	static int direction = 1;
+void editorFuzzyFree(struct editorFuzzy* f){
+	editorFuzzyStop(f);
+	pthread_mutex_destroy(&f->lock);
+	free(f->typed);
+	free(f->query);
+	free(f->chunks);
+	free(f->chunkline);
+	free(f);
+}
 
-	static int saved_hl_line;
-	static char* saved_hl = NULL;
-	
-	// Saves the line which is highlighted and its original highlight
-	if (saved_hl) {
-		memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
-		free(saved_hl);
-		saved_hl = NULL;
-	}
+// Waits a little for results or a key and redraws when the workers published something.
+// Returns 1 while workers are still scoring.
+int editorFuzzyIdle(){
+	struct editorFuzzy* f = E.fuzzy;
+	if (f == NULL || f->nthreads == 0) return 0;
 
-	if(key == '\r' || key == '\x1b'){
-		last_match = -1;
-		direction = 1;
-		return;
-	} else if (key == ARROW_RIGHT || key == ARROW_DOWN){
-		direction = 1;
-	} else if (key == ARROW_LEFT || key == ARROW_UP){
-		direction = -1;
-	} else {
-		last_match = -1;
-		direction = 1;
-	}
+	// waits for a key or a little while, whichever comes first
+	editorInputFill(20);
 
-	if (last_match == -1) direction =1;
-	int current = last_match;
-	int i;
-	for (i = 0; i < E.numrows; i++){
-		current += direction;
-		if (current == -1) current = E.numrows - 1;
-		else if (current == E.numrows) current = 0;
-
-		erow* row = &E.row[current];
-		char* match = strstr(row->render,query);
-		if (match){
-			last_match = current;
-			E.cy = current;
-			E.cx = editorRowRxToCx(row, match - row->render);
-			E.rowoff = E.numrows;
-			
-			// restores original highlight
-			saved_hl_line = current;
-			saved_hl = malloc(row->rsize);
-			memcpy(saved_hl, row->hl, row->rsize);
+	pthread_mutex_lock(&f->lock);
+	int running = f->running;
+	int changed = f->version != f->shown;
+	pthread_mutex_unlock(&f->lock);
 
-			memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
-			break;
+	if (!running) editorFuzzyStop(f);
+	if (changed) editorRefreshScreen();
+	return running;
+}
+
+void editorFuzzyCallback(char* query, int key){
+	struct editorFuzzy* f = E.fuzzy;
+	if (key == '\r' || key == '\x1b'){
+		editorFuzzyStop(f);
+		if (key == '\r' && f->selected < f->ntop){
+			E.cy = f->top[f->selected].line;
+			E.cx = 0;
+			E.rowoff = E.numrows; // puts the line at the top of the screen
 		}
+		return;
+	}
+
+	if (key == ARROW_UP || key == ARROW_DOWN){
+		pthread_mutex_lock(&f->lock);
+		if (key == ARROW_UP && f->selected > 0) f->selected--;
+		if (key == ARROW_DOWN && f->selected < f->ntop - 1) f->selected++;
+		f->version++;
+		pthread_mutex_unlock(&f->lock);
+		return;
 	}
+
+	if (f->typed && !strcmp(f->typed, query)) return;
+	editorFuzzyStart(f, query);
 }
 
-// Implements the search function, asks for a query and returns first instance of it in file
-void editorFind(){
-	// Saving current cursor position incase user cancels search
+// Lets the user type a fuzzy query and shows the best matching lines as they come in
+void editorFuzzyFind(){
 	int saved_cx = E.cx;
 	int saved_cy = E.cy;
 	int saved_coloff = E.coloff;
 	int saved_rowoff = E.rowoff;
 
-	char* query = editorPrompt("Search: %s (Use ESC/Arrows/Enter)", editorFindCallback);
-	
+	E.fuzzy = editorFuzzyNew();
+	char* query = editorPrompt("Fuzzy: %s (Use ESC/Up/Down/Enter)", editorFuzzyCallback);
+	editorFuzzyFree(E.fuzzy);
+	E.fuzzy = NULL;
+
 	if (query){
 		free(query);
 	}
@@ -730,29 +5184,37 @@ void editorFind(){
 	}
 }
 
-
 /** append buffer **/
 
 // creating a dynamic string type for write buffer
 struct abuf{
 	char* b;
 	int len;
+	int cap;
 };
 
 // constructor
-#define ABUF_INIT {NULL, 0}
+#define ABUF_INIT {NULL, 0, 0}
 
 // appends string s of length len to buffer
 void abAppend(struct abuf* ab, const char* s, int len){
-	char* new = realloc(ab->b, ab->len + len); // Resizes and returns pointer to buffer
-
-	if (new != NULL){
-		memcpy(&new[ab->len],s,len); // Appends string to end of buffer
-		
+	if (ab->len + len > ab->cap){
+		// grows geometrically, buffers are reused across frames so this settles quickly
+		int cap = ab->cap ? ab->cap * 2 : 256;
+		while (cap < ab->len + len) cap *= 2;
+		char* new = xrealloc(ab->b, cap); // Resizes and returns pointer to buffer
+		if (new == NULL) return;
 		// re-assigns buffer pointer to new
 		ab->b = new;
-		ab->len +=len;	
+		ab->cap = cap;
 	}
+	memcpy(&ab->b[ab->len],s,len); // Appends string to end of buffer
+	ab->len +=len;
+}
+
+// empties the buffer but keeps its memory
+void abReset(struct abuf* ab){
+	ab->len = 0;
 }
 
 // ~abuf | destructor
@@ -765,14 +5227,15 @@ void abFree(struct abuf* ab){
 void editorScroll(){
 	E.rx = 0;
 	if (E.cy < E.numrows){
-		E.rx = editorRowCxToRx(&E.row[E.cy],E.cx);
+		E.rx = editorRowCxToRx(editorRowAt(E.cy),E.cx);
 	}
 
 	if (E.cy < E.rowoff){ // if cursor position is above screen, go up
 		E.rowoff = E.cy;
 	}
-	if (E.cy >= E.rowoff + E.screenrows){
-		E.rowoff = E.cy - E.screenrows +1;
+	int rows = editorTextRows();
+	if (E.cy >= E.rowoff + rows){
+		E.rowoff = E.cy - rows +1;
 	}
 	if (E.rx < E.coloff){
 		E.coloff = E.rx;
@@ -782,11 +5245,106 @@ void editorScroll(){
 	}
 }
 
+// forgets what the terminal shows so the next refresh repaints every line
+void editorInvalidateFrame(){
+	for (int y = 0; y < E.framelines; y++) abFree(&E.frame[y]);
+	free(E.frame);
+	E.frame = NULL;
+	E.framelines = 0;
+}
+
+// Compares a freshly drawn screen line with what is on the terminal and only sends it
+// if it changed. Consecutive changed lines are reached with \r\n, anything else with
+// an explicit cursor move. A changed line is swapped with the frame's copy, so line
+// comes back holding the old copy's memory for the next line to be drawn into.
+void editorFrameLine(struct abuf* ab, int y, struct abuf* line, int* lasty){
+	struct abuf* prev = &E.frame[y];
+	if (prev->b && prev->len == line->len && !memcmp(prev->b, line->b, line->len)){
+		return;
+	}
+
+	if (*lasty == y - 1 && y > 0){
+		abAppend(ab, "\r\n", 2);
+	}
+	else{
+		char buf[16];
+		int blen = snprintf(buf, sizeof(buf), "\x1b[%d;1H", y + 1);
+		abAppend(ab, buf, blen);
+	}
+	abAppend(ab, line->b, line->len);
+	*lasty = y;
+
+	struct abuf old = *prev;
+	*prev = *line;
+	*line = old;
+}
+
+// Fills hlEscape from editorSyntaxToColor, drawing then copies these instead of
+// formatting an escape on every color change
+void editorBuildEscapes(){
+	for (int hl = 0; hl < HL_TYPES; hl++){
+		// normal text goes back to the default color
+		int color = hl == HL_NORMAL ? 39 : editorSyntaxToColor(hl);
+		hlEscapeLen[hl] = snprintf(hlEscape[hl], sizeof(hlEscape[hl]), "\x1b[%d;1m", color);
+	}
+}
+
+// Draws one line of fuzzy find results, the selected one inverted
+void editorFuzzyDrawRow(struct abuf* ab, int y){
+	struct editorFuzzy* f = E.fuzzy;
+	int rows = editorTextRows();
+	int first = f->selected >= rows ? f->selected - rows + 1 : 0;
+	int i = first + y;
+	if (i >= f->ntop){
+		abAppend(ab, "~", 1);
+		return;
+	}
+	int line = f->top[i].line;
+	erow* row = editorRowAt(line);
+	char num[16];
+	int len = snprintf(num, sizeof(num), "%7d  ", line + 1);
+	if (len > E.screencols) len = E.screencols;
+	if (i == f->selected) abAppend(ab, "\x1b[7m", 4);
+	abAppend(ab, num, len);
+	for (int j = 0; j < row->size && len < E.screencols; j++, len++){
+		// tabs and other control chars would throw the columns off
+		char c = iscntrl((unsigned char)row->chars[j]) ? ' ' : row->chars[j];
+		abAppend(ab, &c, 1);
+	}
+	if (i == f->selected) abAppend(ab, "\x1b[m", 3);
+}
+
+// draws line i of the stats overlay, inverted so it stands out from the text
+void editorStatsDrawRow(struct abuf* ab, int i){
+	char line[256];
+	int len = editorStatsLine(line, sizeof(line), i);
+	if (len > E.screencols) len = E.screencols;
+	abAppend(ab, "\x1b[7m", 4);
+	abAppend(ab, line, len);
+	abAppend(ab, "\x1b[m", 3);
+}
+
 // Prints each line reading from a file
-void editorDrawRows(struct abuf* ab){
+void editorDrawRows(struct abuf* out, int* lasty){
+	// workers keep merging results, hold them still for the whole frame
+	if (E.fuzzy){
+		pthread_mutex_lock(&E.fuzzy->lock);
+		E.fuzzy->shown = E.fuzzy->version;
+	}
+	static struct abuf line = ABUF_INIT;
+	struct abuf* ab = &line;
+	int overlay = editorTextRows();
 	for (int y=0; y<E.screenrows; y++){
+		// each screen line is drawn on its own so it can be compared with the last frame
+		abReset(ab);
 		int filerow = y + E.rowoff;
-		if (filerow >= E.numrows){
+		if (y >= overlay){
+			editorStatsDrawRow(ab, y - overlay);
+		}
+		else if (E.fuzzy && E.fuzzy->qlen){
+			editorFuzzyDrawRow(ab, y);
+		}
+		else if (filerow >= E.numrows){
 			// prints welcome message
 			if (E.numrows == 0 && y == E.screenrows/3){
 				char welcome[80];
@@ -807,33 +5365,33 @@ void editorDrawRows(struct abuf* ab){
 				abAppend(ab,"~",1);
 			}
 		} else {
-			int len = E.row[filerow].rsize - E.coloff;
-			if (len <0) len =0;
+			erow* row = editorRowAt(filerow);
+			editorRowPrepare(row, filerow);
+			// render of long rows starts at rx0. Scrolled past the row's end it shows
+			// nothing, off is kept inside render and hl.
+			int off = E.coloff - row->rx0;
+			if (off < 0) off = 0;
+			if (off > row->rsize) off = row->rsize;
+			int len = row->rsize - off;
 			if (len > E.screencols) len = E.screencols;
-			char* c = &E.row[filerow].render[E.coloff];
-			unsigned char* hl = &E.row[filerow].hl[E.coloff];
+			char* c = &row->render[off];
+			unsigned char* hl = editorSearchHighlight(row, row->rx0 + off, len, &row->hl[off]);
 			int current_color = -1;
-			int j;
-			// Prints char by char, if its a digit, then changes color and adds it
-			for (j=0; j<len; j++){
-				if (hl[j] == HL_NORMAL){
-					if (current_color != -1){
-						abAppend(ab, "\x1b[39;1m",7); // code reset colors
-						current_color = -1;
-					}
-					abAppend(ab, &c[j], 1);
-				} else {
-					int color = editorSyntaxToColor(hl[j]);
-					if (color != current_color){
-						current_color = color;
-						char buf[16];
-						int clen = snprintf(buf, sizeof(buf), "\x1b[%d;1m",color);
-						abAppend(ab, buf, clen);
-					}
-					abAppend(ab, &c[j], 1);
+			int j = 0;
+			// Prints a run of chars with the same highlight at a time, switching color
+			// only when the run's color differs from the last one
+			while (j < len){
+				int k = j + 1;
+				while (k < len && hl[k] == hl[j]) k++;
+				int color = hl[j] == HL_NORMAL ? -1 : editorSyntaxToColor(hl[j]);
+				if (color != current_color){
+					current_color = color;
+					abAppend(ab, hlEscape[hl[j]], hlEscapeLen[hl[j]]);
 				}
+				abAppend(ab, &c[j], k - j);
+				j = k;
 			}
-			abAppend(ab, "\x1b[39;1m",7);
+			abAppend(ab, hlEscape[HL_NORMAL], hlEscapeLen[HL_NORMAL]);
 		}
 		// 4 -> writing 4 bytes to terminal
 		// \x1b is the escape character
@@ -841,18 +5399,41 @@ void editorDrawRows(struct abuf* ab){
 		// K command erases part of current line
 		// 0 is the default argument to K, clear entire line to right of cursor
 		abAppend(ab,"\x1b[K",3);
-		// Does not print new line on last line
-		abAppend(ab,"\r\n",2);
+		editorFrameLine(out, y, &line, lasty);
 	}
+	if (E.fuzzy) pthread_mutex_unlock(&E.fuzzy->lock);
 }
 
 // Creates a status bar at the end of the page
-void editorDrawStatusBar(struct abuf* ab){
+void editorDrawStatusBar(struct abuf* out, int* lasty){
+	static struct abuf line = ABUF_INIT;
+	struct abuf* ab = &line;
+	abReset(ab);
 	abAppend(ab, "\x1b[7m",4); // Inverts colors
 	char status[80], rstatus[80];
-	int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
+	// which buffer this is, once there are several
+	char which[32] = "";
+	if (buffers.n > 1) snprintf(which, sizeof(which), "[%d/%d] ", buffers.cur + 1, buffers.n);
+	int len = snprintf(status, sizeof(status), "%s%.20s - %d lines %s", which,
 		 E.filename ? E.filename : "[No name]", E.numrows,E.dirty?"(modified)":""); // Copies filename to status and returns size to len, if doesnt exist puts "[No Name]"
-	int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
+	// match count while searching, with a '+' until the whole file has been scanned
+	char matches[48] = "";
+	if (E.search && E.search->err){
+		snprintf(matches, sizeof(matches), "regex: %s | ", E.search->err);
+	}
+	else if (E.search && E.search->qlen){
+		snprintf(matches, sizeof(matches), "%lld%s %smatches | ", E.search->total,
+			editorSearchDone(E.search) ? "" : "+", E.search->regex ? "regex " : "");
+	}
+	else if (E.search && E.search->regex){
+		snprintf(matches, sizeof(matches), "regex | ");
+	}
+	if (E.fuzzy && E.fuzzy->qlen){
+		pthread_mutex_lock(&E.fuzzy->lock);
+		snprintf(matches, sizeof(matches), "%d/%d scored | ", E.fuzzy->scanned, E.numrows);
+		pthread_mutex_unlock(&E.fuzzy->lock);
+	}
+	int rlen = snprintf(rstatus, sizeof(rstatus), "%s%s | %d/%d", matches,
 		E.syntax ? E.syntax->filetype : "no ft", E.cy+1,E.numrows); // Outputs filetype and line num
 	if (len > E.screencols) len = E.screencols; // Truncates the size to screenwidth
 	abAppend(ab,status,len);
@@ -867,12 +5448,14 @@ void editorDrawStatusBar(struct abuf* ab){
 		}
 	}
 	abAppend(ab, "\x1b[m",3); // Reverts colors back to normal
-	abAppend(ab, "\r\n", 2); // Making space for further status messages
+	editorFrameLine(out, E.screenrows, &line, lasty);
 }
 
 // Displays a message at the bottom of the screen
-void editorDrawMessageBar(struct abuf* ab){
-	abAppend(ab, "\x1b[K",3); // clear the message bar
+void editorDrawMessageBar(struct abuf* ab, int* lasty){
+	static struct abuf line = ABUF_INIT;
+	abReset(&line);
+	abAppend(&line, "\x1b[K",3); // clear the message bar
 
 	// ensure that message fits the screen
 	int msglen = strlen(E.statusmsg);
@@ -880,34 +5463,60 @@ void editorDrawMessageBar(struct abuf* ab){
 
 	//make sure message is less than 5 seconds old
 	if (msglen && (time(NULL) - E.statusmsg_time < 5)){
-		abAppend(ab, E.statusmsg, msglen);
+		abAppend(&line, E.statusmsg, msglen);
 	}
+	editorFrameLine(ab, E.screenrows + 1, &line, lasty);
 }
 
-// Refreshes screen with new ouput every step
+// Refreshes screen with new ouput every step, only lines that differ from the
+// previous frame are sent
 void editorRefreshScreen(){
 	editorScroll();
-	struct abuf ab = ABUF_INIT;
-	// hides the cursor
-	abAppend(&ab, "\x1b[?25l",6);
 
-	// H command repositions cursor
-	// It takes two arguments, but defaults to 1;1
-	abAppend(&ab,"\x1b[H", 3);
+	if (E.framelines != E.screenrows + 2){
+		editorInvalidateFrame();
+		E.framelines = E.screenrows + 2;
+		E.frame = xcalloc(E.framelines, sizeof(struct abuf));
+	}
 
-	editorDrawRows(&ab);
-	editorDrawStatusBar(&ab);
-	editorDrawMessageBar(&ab);
+	// the whole frame is built in one buffer that lives across frames. It starts with
+	// hiding the cursor, which is skipped when no line changed.
+	static struct abuf ab = ABUF_INIT;
+	abReset(&ab);
+	abAppend(&ab, "\x1b[?25l",6);
+	int lasty = -2;
+	long long probe = editorNanos();
+	editorDrawRows(&ab, &lasty);
+	statAdd(STAT_DRAW, editorNanos() - probe);
+	editorDrawStatusBar(&ab, &lasty);
+	editorDrawMessageBar(&ab, &lasty);
+	int drawn = ab.len > 6;
+
+	int cy = E.cy - E.rowoff + 1; // add 1 to conform to 1 based indexing of terminal
+	int cx = E.rx - E.coloff + 1;
+	if (!drawn && cy == E.frame_cy && cx == E.frame_cx){
+		E.frame_bytes = 0;
+		editorStatsFrame();
+		return;
+	}
 
 	// Repositions cursor
 	char buf[32];
-	snprintf(buf,sizeof(buf),"\x1b[%d;%dH",E.cy-E.rowoff + 1,E.rx - E.coloff+1); // add 1 to conform to 1 based indexing of terminal
-	abAppend(&ab, buf, strlen(buf));
-
-	abAppend(&ab, "\x1b[?25h",6);	// shows the cursor
-
-	write(STDOUT_FILENO, ab.b,ab.len);
-	abFree(&ab);
+	int blen = snprintf(buf,sizeof(buf),"\x1b[%d;%dH",cy,cx);
+	abAppend(&ab, buf, blen);
+
+	if (drawn) abAppend(&ab, "\x1b[?25h",6);	// shows the cursor
+
+	int skip = drawn ? 0 : 6;
+	probe = editorNanos();
+	write(E.outfd, ab.b + skip, ab.len - skip);
+	statAdd(STAT_WRITE, editorNanos() - probe);
+	E.frame_cy = cy;
+	E.frame_cx = cx;
+	E.frame_bytes = ab.len - skip;
+	E.total_frame_bytes += ab.len - skip;
+	stats.frames++;
+	editorStatsFrame();
 }
 
 /** Sets a message to be set in status bar 
@@ -926,9 +5535,28 @@ void editorSetStatusMessage(const char* fmt, ...){
 
 /** input **/
 
+// Runs a slice of whatever background work is pending and redraws what it changed.
+// Called while waiting for a key, returns 1 while there is more to do.
+int editorIdle(){
+	int more = 0;
+	editorPageTrim();
+	if (E.search && !editorSearchDone(E.search)){
+		more |= editorSearchIdle();
+		editorRefreshScreen();
+	}
+	more |= editorFuzzyIdle();
+	editorSaveIdle();
+	return more;
+}
+
 char* editorPrompt(char* prompt, void (*callback)(char*, int)){
+	return editorPromptRead(prompt, callback, 0);
+}
+
+// editorPrompt, where Enter on an empty answer returns it if empty is set
+char* editorPromptRead(char* prompt, void (*callback)(char*, int), int empty){
 	size_t bufsize = 128;
-	char* buf = malloc(bufsize);
+	char* buf = xmalloc(bufsize);
 
 	size_t buflen = 0;
 	buf[0] = '\0';
@@ -954,7 +5582,7 @@ char* editorPrompt(char* prompt, void (*callback)(char*, int)){
             return NULL;
         }
 		else if (c=='\r'){
-			if(buflen !=0){
+			if(buflen !=0 || empty){
 				editorSetStatusMessage("");
 				if (callback) callback(buf, c);
 				return buf; 
@@ -964,7 +5592,7 @@ char* editorPrompt(char* prompt, void (*callback)(char*, int)){
             // doubles memory allocated to str in case its not enough
 			if (buflen == bufsize-1){
 				bufsize *= 2;
-				buf = realloc(buf, bufsize);
+				buf = xrealloc(buf, bufsize);
 			}
 			buf[buflen++] = c;
 			buf[buflen] = '\0';
@@ -974,9 +5602,34 @@ char* editorPrompt(char* prompt, void (*callback)(char*, int)){
 	}
 }
 
+// Reads pasted text up to the closing ESC[201~ and inserts all of it at once,
+// so a paste costs one refresh instead of one per char
+void editorPaste(){
+	const char* end = "\x1b[201~";
+	int endlen = strlen(end);
+	size_t cap = 4096;
+	size_t len = 0;
+	char* buf = xmalloc(cap);
+	int c;
+	// a terminal that never closes the paste gets a second to do so
+	while ((c = editorInputByte(1000)) != -1){
+		if (len == cap){
+			cap *= 2;
+			buf = xrealloc(buf, cap);
+		}
+		buf[len++] = c;
+		if (len >= (size_t)endlen && !memcmp(&buf[len - endlen], end, endlen)){
+			len -= endlen;
+			break;
+		}
+	}
+	editorInsertText(buf, len);
+	free(buf);
+}
+
 // allows user to move using arrow keys
 void editorMoveCursor(int key){
-	erow* row = (E.cy >=E.numrows)?NULL:&E.row[E.cy];
+	erow* row = editorRowAt(E.cy);
 
 	switch (key) {
 		case ARROW_LEFT:
@@ -985,7 +5638,7 @@ void editorMoveCursor(int key){
 			}
 			else if (E.cy > 0){
 				E.cy--;
-				E.cx = E.row[E.cy].size;
+				E.cx = editorRowAt(E.cy)->size;
 			}
 			break;
 		case ARROW_RIGHT:
@@ -1007,7 +5660,7 @@ void editorMoveCursor(int key){
 			break;
 	}
 
-	row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+	row = editorRowAt(E.cy);
 	int rowlen = row ? row->size:0;
 	if (E.cx > rowlen){
 		E.cx = rowlen;
@@ -1018,23 +5671,35 @@ void editorMoveCursor(int key){
 // Later -> handle special combinations
 void editorProcessKeypress(){
 	static int quit_times = WYNAUT_QUIT_TIMES;
+	static int close_times = WYNAUT_QUIT_TIMES;
+	static int last_kind = 0;
 
 	int c = editorReadKey();
 
+	// a run of typing or of deleting is undone in one go, anything else ends it
+	int kind = 0;
+	if (c == BACKSPACE || c == CTRL_KEYS('h') || c == DEL_KEY) kind = 2;
+	else if (c == '\t' || (!iscntrl(c) && c < 1000)) kind = 1;
+	if (kind == 0 || kind != last_kind) editorUndoBreak();
+	last_kind = kind;
+
 	switch(c){
 		case '\r':
 			editorInsertNewline();
 			break;
 
 		case CTRL_KEYS('q'):
-			if(E.dirty && quit_times >0){
-				editorSetStatusMessage("WARNING!!! File has unsaved changes.Press Ctrl-Q %d more times to quit.",quit_times);
+			if(editorBuffersDirty() && quit_times >0){
+				editorSetStatusMessage("WARNING!!! %d file(s) have unsaved changes.Press Ctrl-Q %d more times to quit.",
+					editorBuffersDirty(), quit_times);
 				quit_times--;
 				return;
 			}
+			// saves still running get to finish, otherwise the files would stay as they were
+			editorBuffersFinish();
 			// Clears the screen and resets the cursor. See editorRefreshScreen for details
-			write(STDOUT_FILENO,"\x1b[2J",4);
-			write(STDOUT_FILENO,"\x1b[H", 3);
+			write(E.outfd,"\x1b[2J",4);
+			write(E.outfd,"\x1b[H", 3);
 			exit(0);
 			break;
 			
@@ -1048,13 +5713,65 @@ void editorProcessKeypress(){
 
 		case END_KEY:
 			if (E.cy < E.numrows)
-				E.cx = E.row[E.cy].size;
+				E.cx = editorRowAt(E.cy)->size;
 			break;
 
 		case CTRL_KEYS('f'):
 			editorFind();
 			break;
 
+		case CTRL_KEYS('r'):
+			editorReplace();
+			break;
+
+		case CTRL_KEYS('p'):
+			editorFuzzyFind();
+			break;
+
+		case CTRL_KEYS('g'):
+			editorGoto();
+			break;
+
+		case CTRL_KEYS('o'):
+			editorBufferOpen();
+			break;
+
+		case CTRL_KEYS('n'):
+			editorBufferSwitch(1);
+			break;
+
+		case CTRL_KEYS('b'):
+			editorBufferSwitch(-1);
+			break;
+
+		case CTRL_KEYS('t'):
+			stats.shown = !stats.shown;
+			break;
+
+		case CTRL_KEYS('w'):
+			if (E.dirty && close_times > 0){
+				editorSetStatusMessage("WARNING!!! File has unsaved changes.Press Ctrl-W %d more times to close it.", close_times);
+				close_times--;
+				return;
+			}
+			editorBufferClose();
+			break;
+
+		case PASTE_START:
+			editorPaste();
+			break;
+
+		case PASTE_END: // stray end of a paste, nothing to do
+			break;
+
+		case CTRL_KEYS('z'):
+			editorUndo();
+			break;
+
+		case CTRL_KEYS('y'):
+			editorRedo();
+			break;
+
 		case BACKSPACE:
 		case CTRL_KEYS('h'): //Ctrl+H sends same code as what backspace used to
 		case DEL_KEY:
@@ -1069,10 +5786,10 @@ void editorProcessKeypress(){
 					E.cy = E.rowoff;
 				}
 				else if (c == PAGE_DOWN){
-					E.cy = E.rowoff + E.screenrows - 1; // adds screen number of rows to rowoff
+					E.cy = E.rowoff + editorTextRows() - 1; // adds screen number of rows to rowoff
 					if (E.cy > E.numrows) E.cy = E.numrows;
 				}
-				int times = E.screenrows;
+				int times = editorTextRows();
 				while (times--){ // simulates up/down keys being pressed multiple times
 					editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
 				}
@@ -1086,7 +5803,10 @@ void editorProcessKeypress(){
 			editorMoveCursor(c);
 			break;
 
-		case CTRL_KEYS('l'):
+		case CTRL_KEYS('l'): // repaints the whole screen
+			editorInvalidateFrame();
+			break;
+
 		case '\x1b': // <esc> Not doing anything as we are not handling
 			break;
 
@@ -1097,25 +5817,42 @@ void editorProcessKeypress(){
 	}
 
 	quit_times = WYNAUT_QUIT_TIMES;
+	close_times = WYNAUT_QUIT_TIMES;
 }
 
 /** init **/
 
 void initEditor(){
-	E.cx = 0;
-	E.cy = 0;
-	E.rx = 0;
-	E.rowoff = 0;
-	E.coloff = 0;
-	E.numrows = 0;
-	E.row = NULL;
-	E.dirty = 0;
-	E.filename = NULL;
+	editorBufferInit();
 	E.statusmsg[0] = '\0';
 	E.statusmsg_time = 0;
-	E.syntax = NULL;
-
-	if (getWindowsSize(&E.screenrows, &E.screencols) ==-1){
+	E.frame = NULL;
+	E.framelines = 0;
+	E.frame_cy = E.frame_cx = 0;
+	E.frame_bytes = 0;
+	E.total_frame_bytes = 0;
+	editorBuildEscapes();
+	buffers.cap = 4;
+	buffers.list = xmalloc(sizeof(struct editorConfig) * buffers.cap);
+	buffers.n = 1;
+	buffers.cur = 0;
+
+	char* undo_env = getenv("WYNAUT_UNDO_BUDGET");
+	E.undo.budget = undo_env ? atoi(undo_env) : WYNAUT_UNDO_BUDGET;
+
+	char* page_env = getenv("WYNAUT_PAGE_BUDGET");
+	E.page.budget = page_env ? strtoull(page_env, NULL, 10) : WYNAUT_PAGE_BUDGET;
+
+	char* fsync_env = getenv("WYNAUT_FSYNC");
+	E.save_fsync = fsync_env ? atoi(fsync_env) : FSYNC_FILE;
+
+	// before any thread is started, umask is the whole process's
+	mode_t mask = umask(0);
+	umask(mask);
+	E.save_mode = 0666 & ~mask;
+
+	// a replay already knows its screen size
+	if (E.replay == NULL && getWindowsSize(&E.screenrows, &E.screencols) ==-1){
 		die("getWindowsSize");
 	}
 
@@ -1123,14 +5860,65 @@ void initEditor(){
 	E.screenrows -= 2;
 }
 
+void usage(){
+	fprintf(stderr, "usage: wynaut [--replay keys|-] [--size rowsxcols] [--stats file] [file...]\n");
+	exit(1);
+}
+
 int main(int argc, char* argv[]) {
-	enableRawMode();
+	E.infd = STDIN_FILENO;
+	E.outfd = STDOUT_FILENO;
+	E.replay = NULL;
+	E.screenrows = 24;
+	E.screencols = 80;
+
+	// --replay runs without a terminal: keys come from a script, frames go to /dev/null
+	// and timings are printed on exit
+	char** files = xmalloc(sizeof(char*) * argc);
+	int nfiles = 0;
+	for (int i = 1; i < argc; i++){
+		if (!strcmp(argv[i], "--replay") && i + 1 < argc){
+			char* keys = argv[++i];
+			E.infd = strcmp(keys, "-") ? open(keys, O_RDONLY) : STDIN_FILENO;
+			if (E.infd == -1) die(keys);
+			E.replay = xcalloc(1, sizeof(struct editorReplay));
+		}
+		else if (!strcmp(argv[i], "--size") && i + 1 < argc){
+			if (sscanf(argv[++i], "%dx%d", &E.screenrows, &E.screencols) != 2 ||
+					E.screenrows < 3 || E.screencols < 1) usage();
+		}
+		else if (!strcmp(argv[i], "--stats") && i + 1 < argc){
+			stats.dump = argv[++i];
+		}
+		else if (argv[i][0] == '-' && argv[i][1] == '-') usage();
+		else files[nfiles++] = argv[i];
+	}
+
+	// before enableRawMode, atexit runs handlers last in first out so the counters are
+	// written once the terminal is back
+	if (stats.dump) atexit(editorStatsDump);
+	if (E.replay){
+		E.outfd = open("/dev/null", O_WRONLY);
+		if (E.outfd == -1) die("/dev/null");
+		E.replay->start = editorMicros();
+		atexit(editorReplayReport);
+	}
+	else{
+		enableRawMode();
+	}
+	editorSyntaxLoad();
 	initEditor();
-	if (argc >= 2){
-		editorOpen(argv[1]);
+	editorStartWorker();
+	// every file gets a buffer, the first one is shown. A file named twice gets one
+	// buffer, two would overwrite each other's changes.
+	for (int i = 0; i < nfiles; i++){
+		if (i == 0) editorOpen(files[i]);
+		else if (editorBufferFind(files[i]) < 0) editorBufferAdd(files[i]);
 	}
+	editorBufferUse(0);
+	free(files);
 
-	editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
+	if (E.statusmsg[0] == '\0') editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F/R = find/replace | Ctrl-P = fuzzy find | Ctrl-G = go to | Ctrl-O/N/B/W = open/next/prev/close | Ctrl-T = stats | Ctrl-Z/Y = undo/redo");
 
 	while (1){	//Empty while loop that keeps taking input till user enters 'q'
 		editorRefreshScreen();